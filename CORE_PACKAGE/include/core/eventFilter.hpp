@@ -0,0 +1,100 @@
+/**
+ * \file eventFilter.hpp
+ * \author Luca Di Mauro
+ * \brief Header file for EventFilter class
+ */
+
+
+#ifndef EVENT_FILTER_H
+#define EVENT_FILTER_H
+
+#include <json/json.h>
+
+#include <string>
+#include <vector>
+
+
+namespace microservicespp {
+
+	/**
+	 * \class FilterOperator
+	 * \brief Enum which define all comparisons between a payload field and an operand
+	 */
+	enum class FilterOperator {Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, Exists, Missing};
+
+
+
+
+	/**
+	 * \class EventFilter
+	 * \brief Declarative predicate on event payloads, evaluated by EventManager before enqueuing a payload to a subscriber.
+	 * It is built combining field comparisons with operators "&&", "||" and "!", and compiled in a postfix program
+	 * where field paths (e.g. "position.x" or "items.0") are already split. A default constructed filter matches everything
+	 */
+	class EventFilter {
+	private :
+
+		enum class InstructionType {Compare, And, Or, Not};
+
+		struct Instruction {
+			InstructionType type;
+			size_t span;							// Number of instructions of the sub-expression ending here
+			std::vector<std::string> path;
+			FilterOperator comparison;
+			Json::Value operand;
+		};
+
+		std::vector<Instruction> program;
+
+
+		EventFilter combine (const EventFilter &other, InstructionType type) const;
+		bool evaluate (size_t index, const Json::Value &payload) const;
+		static bool compare (const Json::Value &field, FilterOperator comparison, const Json::Value &operand);
+
+
+	public :
+
+		EventFilter () {}
+
+		/**
+		 * \brief Returns a filter which compares field "path" of payloads with "operand"
+		 */
+		static EventFilter where (std::string path, FilterOperator comparison, Json::Value operand= Json::Value ());
+
+		EventFilter operator&& (const EventFilter &other) const;
+		EventFilter operator|| (const EventFilter &other) const;
+		EventFilter operator! () const;
+
+		/**
+		 * \brief Returns true if this filter matches every payload
+		 */
+		bool isEmpty () const {
+			return program.empty ();
+		}
+
+		/**
+		 * \brief Returns true if both filters are built from the same comparisons, combined in the same way
+		 */
+		bool operator== (const EventFilter &other) const;
+		bool operator!= (const EventFilter &other) const	{ return !(*this == other); }
+
+		/**
+		 * \brief Returns true if "payload" satisfies this filter
+		 */
+		bool matches (const Json::Value &payload) const;
+
+		/**
+		 * \brief Splits a field path as "position.x" or "items.0" in its segments
+		 */
+		static std::vector<std::string> splitPath (const std::string &path);
+
+		/**
+		 * \brief Returns the field of "payload" at the split "path", walking objects by key and arrays by index, or
+		 * nullptr if there is none. An empty path is the payload itself
+		 */
+		static const Json::Value *resolve (const Json::Value &payload, const std::vector<std::string> &path);
+	};
+} // namespace microservicespp
+
+
+#endif
@@ -0,0 +1,133 @@
+/**
+ * \file eventJournal.hpp
+ * \author Luca Di Mauro
+ * \brief Header file for EventJournal class
+ */
+
+
+#ifndef EVENT_JOURNAL_H
+#define EVENT_JOURNAL_H
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <string>
+#include <deque>
+#include <cstdint>
+
+
+namespace microservicespp {
+
+	/**
+	 * \class JournalOptions
+	 * \brief Options used to open the event journal
+	 */
+	struct JournalOptions {
+		size_t segmentSize;			// Size in bytes of each segment file
+		unsigned flushInterval;		// Milliseconds between two group commits
+		bool waitDurable;			// If true, triggering a journaled event returns only when its record is on disk
+
+		JournalOptions () : segmentSize (64*1024*1024), flushInterval (5), waitDurable (false) {}
+	};
+
+
+
+
+	namespace utils {
+
+		/**
+		 * \class EventJournal
+		 * \brief Append-only log of triggered events, stored in memory mapped segment files of a directory.
+		 * Each record is identified by an offset, which is its position in the log. Records are copied in the mapping
+		 * by "append" and written to disk by a flusher thread, which syncs all records appended since its last run at once
+		 * (group commit). Each segment file is named after the offset of its first record; on opening, a record torn by
+		 * a crash is detected by its checksum and overwritten by the next append
+		 */
+		class EventJournal {
+		private :
+
+			struct Segment {
+				uint64_t firstOffset;
+				uint64_t nextOffset;
+				char *data;
+				size_t size;
+				size_t used;
+				size_t synced;
+			};
+
+
+			std::string directory;
+			JournalOptions options;
+
+			// Segments are never unmapped before destruction, so their data can be read without "mutex"
+			std::deque<Segment> segments;
+			uint64_t durableOffset;
+			std::mutex mutex;
+			std::condition_variable durableCondition;
+			std::condition_variable flushCondition;
+			bool stopFlusher;
+			std::thread flusher;
+
+
+			/**
+			 * \brief Creates and maps a new empty segment whose first record will have "firstOffset"
+			 */
+			void addSegment (uint64_t firstOffset);
+
+			/**
+			 * \brief Maps an existing segment file, finding the end of its valid records
+			 */
+			void openSegment (const std::string &path, uint64_t firstOffset);
+
+			/**
+			 * \brief Body of flusher thread, which writes appended records to disk
+			 */
+			void flusherLoop ();
+
+
+		public :
+
+			typedef std::function<void (uint64_t offset, const std::string &service, const std::string &eventName,
+										const std::string &payload)> RecordHandler;
+
+
+			EventJournal (std::string directory, JournalOptions options= JournalOptions ());
+			~EventJournal ();
+
+			EventJournal (const EventJournal &)				= delete;
+			EventJournal &operator= (const EventJournal &)	= delete;
+
+
+			/**
+			 * \brief Appends a record and returns its offset. The record is durable only after "sync"
+			 */
+			uint64_t append (const std::string &service, const std::string &eventName, const std::string &payload);
+
+			/**
+			 * \brief Waits until all records up to "offset" are written to disk
+			 */
+			void sync (uint64_t offset);
+
+			/**
+			 * \brief Calls "handler" on each record starting from "fromOffset", in order. Returns the offset following the last
+			 * record read
+			 */
+			uint64_t replay (uint64_t fromOffset, RecordHandler handler);
+
+			/**
+			 * \brief Returns the offset that the next appended record will have
+			 */
+			uint64_t nextOffset ();
+
+			/**
+			 * \brief Returns the options the journal has been opened with
+			 */
+			const JournalOptions &getOptions () const;
+		};
+
+	} // namespace utils
+} // namespace microservicespp
+
+
+#endif
@@ -93,6 +93,22 @@ namespace microservicespp {
 
 
 
+		/**
+		 * \class RequestTimeoutException
+		 * \brief Definition (and implementation) of exception "RequestTimeoutException", stored in the future of a request
+		 * not answered before its deadline.
+		 */
+		class RequestTimeoutException : public EventManagerException {
+		public:
+			RequestTimeoutException (const char *msg) : EventManagerException(msg) { /*Constructor do nothing*/ };
+			RequestTimeoutException (const std::string &msg) : EventManagerException(msg) { /*Constructor do nothing*/ };
+			virtual ~RequestTimeoutException () throw() { /*Destructor do nothing*/ };
+			virtual const char *what() const throw() { return EventManagerException::what(); };
+		};
+
+
+
+
 		/**
 		 * \class ServiceException
 		 * \brief Definition (and implementation) of exception "ServiceException".
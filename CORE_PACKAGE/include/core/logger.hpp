@@ -0,0 +1,29 @@
+/**
+ * \file logger.hpp
+ * \author Luca Di Mauro
+ * \brief Header file for Logger class
+ */
+
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+
+namespace microservicespp {
+
+	/**
+	 * \class Logger
+	 * \brief Class to log messages with different log levels to an output stream
+	 */
+	class Logger {
+	private :
+		// TODO
+
+
+	public :
+		// TODO
+	};
+} // namespace microservicespp
+
+
+#endif
@@ -11,14 +11,31 @@
 #include <json/json.h>
 #include <core/dynamicLoader.hpp>
 #include <core/exceptions.hpp>
+#include <core/logger.hpp>
+#include <core/utils.hpp>
+#include <core/topicTrie.hpp>
+#include <core/eventFilter.hpp>
+#include <core/eventJournal.hpp>
 #include <dynamicThreadPool.h>
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <string>
 #include <list>
+#include <deque>
+#include <vector>
 #include <csignal>
+#include <atomic>
+#include <typeinfo>
+#include <type_traits>
+#include <cstdint>
 #include <map>
+#include <set>
+#include <future>
+#include <chrono>
 
 
 namespace microservicespp {
@@ -50,6 +67,20 @@ namespace microservicespp {
 	typedef std::function<void(void)> Handler;
 
 
+	/**
+	 * \class EventId
+	 * \brief Definition of type "EventId" which identifies an event registered to EventManager
+	 */
+	typedef uint32_t EventId;
+
+
+	/**
+	 * \class SubscriptionId
+	 * \brief Definition of type "SubscriptionId" which identifies a subscription made by "onEvent"
+	 */
+	typedef uint64_t SubscriptionId;
+
+
 	/**
 	 * \class EventHandler
 	 * \brief Definition of type "EventHandler" which represent a callback called by "triggerEvent" operation
@@ -57,6 +88,59 @@ namespace microservicespp {
 	typedef std::function<void (Json::Value)> EventHandler;
 
 
+	/**
+	 * \class SharedPayload
+	 * \brief Definition of type "SharedPayload" which represent a payload frozen by "triggerEvent" and shared by all subscribers
+	 */
+	typedef std::shared_ptr<const Json::Value> SharedPayload;
+
+
+	/**
+	 * \class SharedEventHandler
+	 * \brief Definition of type "SharedEventHandler" which represent a callback called by "triggerEvent" operation
+	 			without copying the payload
+	 */
+	typedef std::function<void (SharedPayload)> SharedEventHandler;
+
+
+	/**
+	 * \class BatchEventHandler
+	 * \brief Definition of type "BatchEventHandler" which represent a callback called once for all payloads of an event
+	 			triggered together by "triggerEvents" operation
+	 */
+	typedef std::function<void (const std::vector<SharedPayload> &)> BatchEventHandler;
+
+
+	/**
+	 * \class PatternEventHandler
+	 * \brief Definition of type "PatternEventHandler" which represent a callback subscribed to a topic pattern,
+	 			called with the identifier of the event which matched it
+	 */
+	typedef std::function<void (EventId, SharedPayload)> PatternEventHandler;
+
+
+	/**
+	 * \class ReplayHandler
+	 * \brief Definition of type "ReplayHandler" which represent a callback called by "replayEvents" operation for each
+	 			journaled payload, with its offset in the journal
+	 */
+	typedef std::function<void (uint64_t, EventId, SharedPayload)> ReplayHandler;
+
+
+	/**
+	 * \class PartitionKeyExtractor
+	 * \brief Definition of type "PartitionKeyExtractor" which represent a function returning the entity a payload refers to
+	 */
+	typedef std::function<std::string (const Json::Value &)> PartitionKeyExtractor;
+
+
+	/**
+	 * \class RequestHandler
+	 * \brief Definition of type "RequestHandler" which represent a callback answering requests made by "request" operation
+	 */
+	typedef std::function<Json::Value (const Json::Value &)> RequestHandler;
+
+
 	/**
 	 * \class TemplateEventHandler
 	 * \brief Definition of type "TemplateEventHandler" which represent a callback called by "triggerEvent" which take
@@ -80,6 +164,13 @@ namespace microservicespp {
 	typedef std::function<void(void)> PrepareShutdownFunction;
 
 
+	/**
+	 * \class StateTransferFunction
+	 * \brief Definition of type "StateTransferFunction" which moves the state of a reloaded service to its new instance
+	 */
+	typedef std::function<void(Service &oldInstance, Service &newInstance)> StateTransferFunction;
+
+
 	/**
 	 * \class EngineStatus
 	 * \brief Enum which describes current engine status
@@ -87,132 +178,1451 @@ namespace microservicespp {
 	enum class EngineStatus {Starting, Running, ShuttingDown, Died};
 
 
-	/**
-	/**
-	 * \class ServiceStatus
-	 * \brief Enum which describes current status of service
-	 */
-	enum class ServiceStatus {Loading, Running, ShuttingDown, Died};
+	/**
+	/**
+	 * \class ServiceStatus
+	 * \brief Enum which describes current status of service
+	 */
+	enum class ServiceStatus {Loading, Running, ShuttingDown, Died};
+
+
+	/**
+	 * \class TaskType
+	 * \brief Enum which define all possibe types of tasks
+	 */
+	enum class TaskType {None, OneShot, Timeout, Periodic};
+
+
+	/**
+	 * \class TaskStatus
+	 * \brief Enum which represents status of current task
+	 */
+	enum class TaskStatus {Waiting, Running, Ended};
+
+
+	/**
+	 * \class BackpressurePolicy
+	 * \brief Enum which describes what happens when an event is triggered and the queue of a subscriber is full:
+	 			the publisher waits, the new payload is discarded, the oldest queued payload is discarded or the
+	 			newest queued payload is replaced
+	 */
+	enum class BackpressurePolicy {Block, DropNewest, DropOldest, Coalesce};
+
+
+	/**
+	 * \class EventPriority
+	 * \brief Enum which describes the dispatch lane of an event. High priority events are served first and by a
+	 			dispatcher reserved to them, so they are never delayed by lower priority ones
+	 */
+	enum class EventPriority {High, Normal, Low};
+
+
+	/**
+	 * \class RateLimitPolicy
+	 * \brief Enum which describes what happens when a publisher exceeds its rate limit: the payload is discarded
+	 			or the publisher waits until its token is available
+	 */
+	enum class RateLimitPolicy {Drop, Delay};
+
+
+	/**
+	 * \class BalancePolicy
+	 * \brief Enum which describes which replica of a service handles a payload: the one with fewest payloads queued or
+	 			being handled, or the one chosen by the key of the payload, so payloads with the same key go to the same replica
+	 */
+	enum class BalancePolicy {LeastLoaded, KeyAffinity};
+
+
+
+
+
+
+
+
+	/* ===================================================================================== */
+	/* ===================================================================================== */
+
+
+
+
+
+
+
+
+	/**
+	 * \class JsonConverter
+	 * \brief Converts typed events from and to Json::Value. It has to be specialized for each type whose events
+	 			are received as json (by json subscribers or by external processes) or are published as json and
+	 			received as typed events
+	 */
+	template <typename T>
+	struct JsonConverter {
+		typedef void Unspecialized;		// Not defined by specializations: marks types without conversion
+
+		static Json::Value toJson (const T &value) {
+			throw exceptions::EventManagerException (std::string ("No json conversion for type ") + typeid (T).name ());
+		}
+
+		static T fromJson (const Json::Value &json) {
+			throw exceptions::EventManagerException (std::string ("No json conversion for type ") + typeid (T).name ());
+		}
+	};
+
+
+	/**
+	 * \class HasJsonConverter
+	 * \brief "value" is true if JsonConverter is specialized for type T
+	 */
+	template <typename T>
+	class HasJsonConverter {
+	private :
+
+		template <typename C>
+		static std::false_type check (typename C::Unspecialized *);
+
+		template <typename C>
+		static std::true_type check (...);
+
+
+	public :
+
+		static const bool value	= decltype (check<JsonConverter<T>> (nullptr))::value;
+	};
+
+	template <typename T>
+	const bool HasJsonConverter<T>::value;
+
+
+
+
+	/**
+	 * \class EventObject
+	 * \brief Immutable payload of a triggered event, shared by all subscribers. It can hold a Json::Value or any C++ object
+	 */
+	class EventObject {
+	public :
+
+		virtual ~EventObject () {}
+
+		/**
+		 * \brief Returns the json form of the payload, converting it on first request
+		 */
+		virtual const Json::Value &asJson () const = 0;
+
+		/**
+		 * \brief Returns type of the object held by this payload
+		 */
+		virtual const std::type_info &type () const = 0;
+
+		/**
+		 * \brief Returns the object held by this payload
+		 */
+		virtual const void *get () const = 0;
+
+		/**
+		 * \brief Returns false if "asJson" cannot convert the payload, since it is an object without JsonConverter
+		 */
+		virtual bool hasJson () const {
+			return true;
+		}
+	};
+
+
+	/**
+	 * \class SharedEventObject
+	 * \brief Definition of type "SharedEventObject" which represent an EventObject shared by all subscribers
+	 */
+	typedef std::shared_ptr<const EventObject> SharedEventObject;
+
+
+
+
+	/**
+	 * \class RateLimit
+	 * \brief Token bucket limit of the payloads triggered by a publisher. A rate over 1e9 payloads per second, or a burst
+	 * taking longer than utils::TokenBucket::maxWindow to be produced, is rejected
+	 */
+	struct RateLimit {
+		double rate;				// Payloads per second, 0 for no limit
+		unsigned burst;				// Payloads which can be triggered at once after an idle period
+		RateLimitPolicy policy;		// What to do with payloads over the limit
+
+		RateLimit () : rate (0), burst (1), policy (RateLimitPolicy::Drop) {}
+		RateLimit (double rate, unsigned burst, RateLimitPolicy policy= RateLimitPolicy::Drop) : rate (rate), burst (burst), policy (policy) {}
+	};
+
+
+
+
+	/**
+	 * \class EventOptions
+	 * \brief Options of an event registered by "registerEvent"
+	 */
+	struct EventOptions {
+		bool conflated;			// Only the latest payload matters: a payload not yet handled by a subscriber is replaced by the new one
+		EventPriority priority;	// Dispatch lane of the event
+		bool journaled;			// Payloads are appended to the event journal, if it is open
+		bool sticky;			// The latest payload is cached, so subscriptions made later can receive it at once
+		RateLimit rateLimit;	// Limit of payloads triggered on the event
+
+		EventOptions () : conflated (false), priority (EventPriority::Normal), journaled (false), sticky (false) {}
+	};
+
+
+
+
+	/**
+	 * \class SubscriptionOptions
+	 * \brief Options of a subscription made by "onEvent"
+	 */
+	struct SubscriptionOptions {
+		size_t queueCapacity;					// Maximum number of payloads waiting to be handled (in each partition)
+		BackpressurePolicy backpressure;		// What to do when queue is full
+		EventFilter filter;						// Payloads not matching it are discarded by the publisher
+		bool lastValue;							// If the event is sticky, its cached payload is delivered at once (not to patterns)
+		PartitionKeyExtractor partitionKey;		// If set, payloads with the same key are handled in order and the others in
+												// parallel, so the handler must be thread safe
+		size_t partitions;						// Number of queues of a partitioned subscription, 0 for one per dispatcher thread
+		std::string owner;						// Service owning the subscription, which is cancelled when the service leaves
+		double maxFailureRate;					// Handler failures per second tolerated before the subscription is suspended,
+												// 0 to never suspend it
+		unsigned failureBurst;					// Failures tolerated at once before the subscription is suspended
+		bool inlineDispatch;					// The handler is called by the publisher thread, so it must be cheap and thread safe
+		unsigned inlineBudget;					// Microseconds an inline handler may take for a payload before being moved
+												// to dispatcher threads for good
+
+		SubscriptionOptions () : queueCapacity (1024), backpressure (BackpressurePolicy::Block), lastValue (false), partitions (0),
+								 maxFailureRate (0), failureBurst (10), inlineDispatch (false), inlineBudget (50) {}
+	};
+
+
+
+
+	/**
+	 * \class WindowOptions
+	 * \brief Time windows of an aggregation made by "aggregateEvent". A window of "size" milliseconds is closed every
+	 			"slide" milliseconds: windows are tumbling if "slide" is 0 or equal to "size", sliding if it divides "size"
+	 */
+	struct WindowOptions {
+		unsigned size;
+		unsigned slide;
+
+		WindowOptions () : size (1000), slide (0) {}
+		WindowOptions (unsigned size, unsigned slide= 0) : size (size), slide (slide) {}
+	};
+
+
+
+
+	/**
+	 * \class SubscriptionStats
+	 * \brief Counters of a subscription made by "onEvent"
+	 */
+	struct SubscriptionStats {
+		size_t queueDepth;
+		size_t queueCapacity;
+		uint64_t delivered;
+		uint64_t dropped;
+		uint64_t coalesced;
+		uint64_t conflated;
+		uint64_t filtered;
+		uint64_t failed;		// Payloads whose handler threw
+		bool suspended;
+		bool inlined;			// False also when an inline subscription has been moved to dispatchers
+	};
+
+
+
+
+	/**
+	 * \class LatencyStats
+	 * \brief Latencies of the payloads of an event handled by a subscription: from trigger to handler start (queue) and
+	 			from handler start to finish (handler). Handlers of batches are timed once per batch
+	 */
+	struct LatencyStats {
+		EventId event;
+		SubscriptionId subscription;
+		utils::LatencyHistogram queue;
+		utils::LatencyHistogram handler;
+	};
+
+
+
+
+	/**
+	 * \class DeadLetter
+	 * \brief A payload whose handler threw, with the error it raised
+	 */
+	struct DeadLetter {
+		SubscriptionId subscription;
+		EventId event;
+		SharedEventObject object;
+		std::string error;
+		std::chrono::system_clock::time_point time;
+	};
+
+
+
+
+	/**
+	 * \class RateLimitStats
+	 * \brief Counters of a rate limit. Delayed payloads are counted also as admitted. A payload dropped by the limit of
+	 * its service is counted only there, not as admitted by the limit of its event
+	 */
+	struct RateLimitStats {
+		uint64_t admitted;
+		uint64_t dropped;
+		uint64_t delayed;
+	};
+
+
+
+
+	/**
+	 * \class JsonEventObject
+	 * \brief Payload of events triggered with a Json::Value
+	 */
+	class JsonEventObject : public EventObject {
+	private :
+
+		SharedPayload payload;
+
+
+	public :
+
+		JsonEventObject (SharedPayload payload) : payload (payload) {}
+
+		const Json::Value &asJson () const			{ return *payload; }
+		const std::type_info &type () const		{ return typeid (Json::Value); }
+		const void *get () const					{ return payload.get (); }
+	};
+
+
+
+
+	/**
+	 * \class TypedEventObject
+	 * \brief Payload of events triggered with an object of type T, which is converted to Json::Value only when requested
+	 */
+	template <typename T>
+	class TypedEventObject : public EventObject {
+	private :
+
+		T value;
+		mutable std::once_flag convertOnce;
+		mutable Json::Value json;
+
+
+	public :
+
+		TypedEventObject (T &&value) : value (std::move (value)) {}
+		TypedEventObject (const T &value) : value (value) {}
+
+		const Json::Value &asJson () const {
+			std::call_once (convertOnce, [this] { json	= JsonConverter<T>::toJson (value); });
+			return json;
+		}
+
+		const std::type_info &type () const		{ return typeid (T); }
+		const void *get () const					{ return &value; }
+		bool hasJson () const						{ return HasJsonConverter<T>::value; }
+	};
+
+
+
+
+	/**
+	 * \class ServiceStartup
+	 * \brief Time spent starting a service by "startServices"
+	 */
+	struct ServiceStartup {
+		std::string name;
+		int runLevel;
+		std::chrono::microseconds loading;			// Opening its shared object
+		std::chrono::microseconds construction;		// Creating the service
+		std::chrono::microseconds starting;			// Running "startMe"
+		std::chrono::microseconds ready;			// From the beginning of "startServices" to the service being started
+	};
+
+
+	/**
+	 * \class LazyActivation
+	 * \brief Events and endpoints which start a service declared by "declareLazyService"
+	 */
+	struct LazyActivation {
+		std::vector<std::string> events;		// Topics ("service/event") or patterns of events handled by the service
+		std::vector<std::string> endpoints;		// Names of endpoints of the service
+		unsigned idleTimeout;					// Milliseconds without events after which the service is stopped, 0 for never
+
+		LazyActivation () : idleTimeout (0) {}
+	};
+
+
+	/**
+	 * \class ReplicaOptions
+	 * \brief Options of a service loaded by "loadReplicatedService"
+	 */
+	struct ReplicaOptions {
+		unsigned replicas;						// Number of instances of the service
+		BalancePolicy balance;
+		PartitionKeyExtractor affinityKey;		// Key of payloads, needed by KeyAffinity
+
+		ReplicaOptions () : replicas (1), balance (BalancePolicy::LeastLoaded) {}
+	};
+
+
+
+
+
+
+
+
+	/* ===================================================================================== */
+	/* ===================================================================================== */
+
+
+
+
+
+
+
+
+	/**
+	 * \class ServiceRegistry
+	 * \brief Its purpose is to keep track of loaded services and to run tasks when requested
+	 */
+	class ServiceRegistry : private Logger {
+	private :
+
+		/**
+		 * \brief A service with the module it has been loaded from. The module is closed after the service is destroyed
+		 */
+		struct ServiceEntry {
+			std::string soPath;
+			std::string name;
+			int runLevel;
+			std::vector<std::string> dependencies;
+			std::shared_ptr<dynamicLoader::DynamicLoader<Service>> loader;
+			std::shared_ptr<Service> service;					// Its deleter keeps the module loaded
+			std::vector<std::unique_ptr<Service>> replicas;		// Other instances of a replicated service
+		};
+
+
+		/**
+		 * \brief Module of a replaced instance, closed once the instance is destroyed and its subscriptions expired
+		 */
+		struct RetiredModule {
+			std::shared_ptr<dynamicLoader::DynamicLoader<Service>> loader;
+			std::vector<std::weak_ptr<const void>> subscriptions;
+		};
+
+
+		/**
+		 * \brief Services to activate, shared with callbacks which may run after the registry is destroyed
+		 */
+		struct ActivationQueue {
+			std::mutex mutex;
+			std::condition_variable condition;
+			std::deque<std::string> requests;
+			bool stop;
+
+			ActivationQueue () : stop (true) {}
+		};
+
+
+		/**
+		 * \brief A service declared by "declareLazyService", which is in "services" only while active
+		 */
+		struct LazyService {
+			std::shared_ptr<ServiceEntry> entry;
+			LazyActivation activation;
+			bool active;
+			bool armed;					// True while placeholders wait for its events, also across a stop of the registry
+			uint64_t activity;			// Activity of its subscriptions at the last idle check
+			bool timed;					// True if "deadline" is set
+			std::chrono::steady_clock::time_point deadline;		// Next idle check if active, else next activation attempt
+		};
+
+
+		Engine &engine;
+		bool started;
+
+		// Running services and services waiting for "startServices"
+		std::map<std::string, std::shared_ptr<ServiceEntry>> services;
+		std::vector<std::shared_ptr<ServiceEntry>> declaredServices;
+		std::vector<ServiceStartup> startupReport;		// Services started by the last "startServices"
+		std::mutex servicesMutex;
+
+		// Modules of replaced instances, kept open while events already dispatched may still run their code
+		std::vector<RetiredModule> retiredModules;
+
+		// Copy of "services" read without locks by "getService", rebuilt under "servicesMutex" on each change
+		utils::SnapshotPointer<utils::FrozenStringMap<std::shared_ptr<Service>>> directory;
+
+		// Lazy services are activated and stopped by "activator", which runs while the registry is started
+		std::map<std::string, std::shared_ptr<LazyService>> lazyServices;
+		std::shared_ptr<ActivationQueue> activations;
+		std::thread activator;
+
+
+		/**
+		 * \brief Opens the module of "entry", creates its service and starts it, storing timings in "startup"
+		 */
+		void bootService (ServiceEntry &entry, ServiceStartup &startup);
+
+		/**
+		 * \brief Throws if a service called "name" is running or declared. Must be called with "servicesMutex" held
+		 */
+		void checkUnique (const std::string &name);
+
+		/**
+		 * \brief Stops and destroys all instances of the service of "entry", keeping its module loaded
+		 */
+		void shutdownService (ServiceEntry &entry);
+
+		/**
+		 * \brief Part of "shutdownService" which calls no hook, so it can run while the registry is destroyed
+		 */
+		void stopInstances (ServiceEntry &entry);
+
+		/**
+		 * \brief Closes retired modules whose subscriptions all expired
+		 */
+		void closeRetiredModules ();
+
+		/**
+		 * \brief Stops "activator" thread, waiting for the activation or the idle check it is running
+		 */
+		void stopActivator ();
+
+		/**
+		 * \brief Marks the registry as stopped and removes all running services, returning them in the order they have
+		 * to be stopped
+		 */
+		std::vector<std::shared_ptr<ServiceEntry>> takeServices ();
+
+		/**
+		 * \brief Replaces "directory" with the current content of "services". Must be called with "servicesMutex" held
+		 */
+		void publishDirectory ();
+
+		/**
+		 * \brief Body of "activator" thread
+		 */
+		void activatorLoop ();
+
+		/**
+		 * \brief Starts lazy service "name" if it is not active, handing it the events it missed
+		 */
+		void activateService (const std::string &name);
+
+		/**
+		 * \brief Stops lazy service "name" if no event reached it since the previous check
+		 */
+		void checkIdleService (const std::string &name);
+
+		/**
+		 * \brief Returns the callback which asks "activator" to start lazy service "name"
+		 */
+		std::function<void ()> activationOf (const std::string &name);
+
+
+	protected :
+
+		/**
+		 * \brief Function to start threads
+		 */
+		void startRegistry ();
+
+		/**
+		 * \brief Function to stop ServiceRegistry. Stopping services may call the hooks, so derived classes call it from
+		 * their destructor: the destructor of ServiceRegistry only stops services left running, calling no hook
+		 */
+		void stopRegistry ();
+
+		/**
+		 * \brief Return whether registry is started or not
+		 */
+		bool isStarted ();
+
+
+		/**
+		 * \brief Loads a Service from shared object and insert it into service map
+		 */
+		void loadService	(std::string soPath, std::string name, int runLevel);
+
+		/**
+		 * \brief Loads a Service from shared object creating "options.replicas" instances of it. Subscriptions of the
+		 * instances to the same event, pattern or endpoint are merged, so each payload is handled by a single instance,
+		 * chosen by "options.balance". Instances must make the same subscriptions, with the same options, while they are
+		 * created and started, otherwise loading fails. "getService" returns the first instance
+		 */
+		void loadReplicatedService	(std::string soPath, std::string name, int runLevel, ReplicaOptions options);
+
+		/**
+		 * \brief Declares a Service to be loaded by "startServices", after all services of the nearest lower run level and
+		 * after "dependencies", which may also be services already running
+		 */
+		void declareService	(std::string soPath, std::string name, int runLevel,
+							 std::vector<std::string> dependencies= std::vector<std::string> ());
+
+		/**
+		 * \brief Loads and starts all declared services. Services which do not depend on each other are opened, created
+		 * and started at the same time. Returns timings of started services, in the order they got ready, which are also
+		 * kept for "getStartupReport". If a service fails, services depending on it are not started, while the others
+		 * still are, and a ServiceRegistryException is thrown: services not started stay declared, so a later call
+		 * retries them. Services depending on unknown services or on a cycle are rejected before starting anything: they
+		 * are discarded, while the other services stay declared
+		 */
+		std::vector<ServiceStartup> startServices ();
+
+		/**
+		 * \brief Returns timings of services started by the last "startServices", also when it failed
+		 */
+		std::vector<ServiceStartup> getStartupReport ();
+
+		/**
+		 * \brief Returns true if exists a service called "name", false otherwise. It never blocks
+		 */
+		bool existsService	(const std::string &name);
+
+		/**
+		 * \brief Unload Service with name "name", destroying it
+		 */
+		void unloadService (std::string name);
+
+		/**
+		 * \brief Returns the Service with this name. The handle keeps the instance and its module alive after the service
+		 * is unloaded or reloaded, when the instance is stopped. It never blocks nor allocates, unless the service does
+		 * not exist
+		 */
+		std::shared_ptr<Service> getService	(const std::string &name);
+		std::shared_ptr<Service> getService	(const char *name);
+
+		/**
+		 * \brief Replaces the running service "name" with a new instance loaded from "soPath", which must differ from the
+		 * path of the running one. The new instance is created and started alongside the old one; then delivery to the old
+		 * instance is paused, "transfer" is called and routing is flipped at once, so events published meanwhile are
+		 * buffered and handed to the new instance. If any step fails, the old instance goes on running. Replicated and lazy
+		 * services cannot be reloaded
+		 */
+		void reloadService	(std::string name, std::string soPath, StateTransferFunction transfer= nullptr);
+
+
+		/**
+		 * \brief Declares a service which is loaded and started only when an event or a request of "activation" comes,
+		 * instead of by "startServices". Such payloads are kept until the service is started, and then handed to its
+		 * subscriptions with the same event, pattern or endpoint. If "activation.idleTimeout" is set, the service is
+		 * stopped again when idle, and its module stays loaded for the next activation
+		 */
+		void declareLazyService	(std::string soPath, std::string name, int runLevel, LazyActivation activation);
+
+
+		/**
+		 * \brief Hooks called by "reloadService" on the event side: before the new instance is created, before "transfer"
+		 * and at the end, with "commit" true if the new instance replaces the old one. A lazy service is activated and
+		 * stopped as a reload too. When committing, the last one returns the subscriptions of the old instance, which
+		 * expire once their handlers cannot run anymore
+		 */
+		virtual void reloadBegin	(const std::string &name) = 0;
+		virtual void reloadPause	(const std::string &name) = 0;
+		virtual std::vector<std::weak_ptr<const void>> reloadEnd	(const std::string &name, bool commit) = 0;
+
+		/**
+		 * \brief Hooks called for lazy services: the first keeps payloads of "activation" on behalf of service "name" and
+		 * calls "activate" when one comes, the second returns a value which changes whenever the service receives events
+		 */
+		virtual void lazyArm			(const std::string &name, const LazyActivation &activation, std::function<void ()> activate) = 0;
+		virtual uint64_t lazyActivity	(const std::string &name) = 0;
+
+		/**
+		 * \brief Hook called before instances of a replicated service are created, and with default options after they
+		 * are destroyed
+		 */
+		virtual void replicateService	(const std::string &name, const ReplicaOptions &options) = 0;
+
+		/**
+		 * \brief Hooks called for replicated services: the first before instance "replica" is created, so subscriptions
+		 * made until the next call are of that instance, and the second after all instances are started. The second throws
+		 * if the instances did not make the same subscriptions
+		 */
+		virtual void replicaBegin	(const std::string &name, unsigned replica) = 0;
+		virtual void replicaEnd		(const std::string &name) = 0;
+
+
+	public :
+
+		ServiceRegistry				(Engine &engine);
+		virtual ~ServiceRegistry	() = 0;
+	};
+
+
+
+
+
+
+
+
+	/* ===================================================================================== */
+	/* ===================================================================================== */
+
+
+
+
+
+
+
+
+	/**
+	 * \class EventManager
+	 * \brief This class has the aim of register all throwable events by services with their subscriber and, when a service is fired, to call subscriber's callbacks
+	 */
+	class EventManager : private Logger {
+	private :
+
+		/**
+		 * \brief A payload waiting to be handled by a subscriber
+		 */
+		struct PendingEvent {
+			EventId event;
+			SharedEventObject object;
+			int64_t enqueued;			// Time of enqueuing while latencies are traced, 0 otherwise
+		};
+
+
+		/**
+		 * \brief Payloads of a mailbox with the same priority, in order of arrival
+		 */
+		struct MailboxLane {
+			std::deque<PendingEvent> pending;
+			uint64_t headSequence;								// Sequence number of the first pending payload
+			std::map<EventId, uint64_t> conflatedSlots;		// Sequence number of the pending payload of each conflated event
+
+			MailboxLane () : headSequence (0) {}
+
+			/**
+			 * \brief Removes the first pending payload
+			 */
+			void popFront () {
+				auto slot	= conflatedSlots.find (pending.front ().event);
+				if (slot != conflatedSlots.end () && slot->second == headSequence)
+					conflatedSlots.erase (slot);
+
+				pending.pop_front ();
+				headSequence++;
+			}
+
+			/**
+			 * \brief Removes the last pending payload
+			 */
+			void popBack () {
+				auto slot	= conflatedSlots.find (pending.back ().event);
+				if (slot != conflatedSlots.end () && slot->second == headSequence + pending.size () - 1)
+					conflatedSlots.erase (slot);
+
+				pending.pop_back ();
+			}
+		};
+
+
+		/**
+		 * \brief Bounded queue of payloads waiting to be handled by a subscriber. Payloads wait in the lane of their priority,
+		 * and the capacity is shared by all lanes
+		 */
+		struct Mailbox {
+			std::mutex mutex;
+			std::condition_variable notFull;
+			MailboxLane lanes[3];								// One for each EventPriority, drained from the high priority one
+			bool scheduled;										// True while the mailbox is in "readyMailboxes" or being drained
+			bool draining;										// True while a dispatcher calls handlers on its payloads
+			EventPriority scheduledLane;						// Lane of "readyMailboxes" where the mailbox was scheduled
+			uint64_t ticket;									// Changed at each scheduling, so dispatchers skip older entries
+			uint64_t lastSequence;								// Sequence number of the latest payload of a sticky event
+
+			std::atomic<uint64_t> delivered;
+			std::atomic<uint64_t> dropped;
+			std::atomic<uint64_t> coalesced;
+			std::atomic<uint64_t> conflated;
+			std::atomic<uint64_t> filtered;
+
+			size_t replica;										// Replica handling payloads of the mailbox
+			std::atomic<size_t> load;							// Payloads queued or being handled, counted only for replicas
+
+			Mailbox () : scheduled (false), draining (false), scheduledLane (EventPriority::Normal), ticket (0), lastSequence (0), delivered (0),
+						 dropped (0), coalesced (0), conflated (0), filtered (0), replica (0), load (0) {}
+
+			/**
+			 * \brief Returns the lane of "priority"
+			 */
+			MailboxLane &lane (EventPriority priority) {
+				return lanes[static_cast<size_t> (priority)];
+			}
+
+			/**
+			 * \brief Returns the priority of the first non empty lane, setting "found" to false if all lanes are empty
+			 */
+			EventPriority topPriority (bool &found) const {
+				for (size_t i=0; i<3; i++) {
+					if (!lanes[i].pending.empty ()) {
+						found	= true;
+						return static_cast<EventPriority> (i);
+					}
+				}
+
+				found	= false;
+				return EventPriority::Normal;
+			}
+
+			/**
+			 * \brief Returns the number of pending payloads of all lanes
+			 */
+			size_t size () const {
+				return lanes[0].pending.size () + lanes[1].pending.size () + lanes[2].pending.size ();
+			}
+		};
+
+
+		/**
+		 * \brief A callback registered by "onEvent". Only its mailboxes, its events and its state change after creation
+		 */
+		struct Subscription {
+			SubscriptionId id;
+			SubscriptionOptions options;
+			std::string pattern;									// Empty if subscribed to a single event
+			std::function<void (EventId, const SharedEventObject &)> handler;
+			std::function<void (const std::vector<SharedEventObject> &)> batchHandler;
+			const std::type_info *objectType;						// Type handled without converting it to json, null for json handlers
+			std::vector<std::unique_ptr<Mailbox>> mailboxes;		// One for each partition, each drained by a dispatcher at a time
+			std::vector<EventId> events;							// Events whose entry lists the subscription, under "tableMutex"
+			std::atomic<bool> cancelled;							// Pending payloads of a cancelled subscription are discarded
+			std::atomic<bool> suspended;							// Payloads of a suspended subscription are discarded
+			std::atomic<uint64_t> failed;
+			std::unique_ptr<utils::TokenBucket> failureBudget;		// Each failure takes a token, and none left means suspension
+			std::atomic<bool> inlined;								// Payloads are handled by publishers
+			std::atomic<unsigned> inlineDeliveries;					// Publishers handling payloads inline right now
+			std::atomic<bool> paused;								// Payloads of a paused subscription wait in its mailboxes
+			std::function<void ()> activation;						// Set only on placeholders of lazy services, which stay paused
+			std::atomic<bool> activating;							// The placeholder called "activation"
+
+			// Handlers of each replica of the owner, one for each mailbox. Empty if the owner is not replicated
+			std::vector<std::pair<std::function<void (EventId, const SharedEventObject &)>,
+								  std::function<void (const std::vector<SharedEventObject> &)>>> replicaHandlers;
+			size_t joinedReplicas;									// Replicas whose handlers are set, under "tableMutex"
+			mutable std::atomic<size_t> nextReplica;				// Where the search of the least loaded replica starts
+
+			Subscription () : objectType (nullptr), cancelled (false), suspended (false), failed (0), inlined (false), inlineDeliveries (0), paused (false),
+							  activating (false), joinedReplicas (0), nextReplica (0) {}
+		};
+
+
+		/**
+		 * \brief Payloads which a publisher could not enqueue while reading the table, since the queue of their subscription
+		 * is full or their handler is inline. They are enqueued, waiting for room, or handled after the table is released
+		 */
+		struct DeferredPayloads {
+			std::shared_ptr<Subscription> subscription;
+			EventId event;
+			EventOptions eventOptions;
+			std::vector<SharedEventObject> objects;		// Already filtered
+			std::vector<uint64_t> sequences;			// Empty if payloads come without sequences
+		};
+
+
+		/**
+		 * \brief A mailbox waiting for a dispatcher, with the subscription which keeps it alive
+		 */
+		struct ReadyMailbox {
+			std::shared_ptr<Subscription> subscription;
+			Mailbox *mailbox;
+			uint64_t ticket;		// Ticket of the mailbox when scheduled: a different one means the entry is stale
+		};
+
+
+		/**
+		 * \brief State of an event changed by "triggerEvent", shared by all copies of its entry
+		 */
+		struct EventRuntime {
+			std::mutex mutex;
+			SharedEventObject lastValue;		// Latest payload of a sticky event
+			uint64_t sequence;					// Number of payloads triggered on a sticky event
+
+			EventRuntime () : sequence (0) {}
+		};
+
+
+		/**
+		 * \brief Accumulators of an aggregation made by "aggregateEvent". A window is split in panes as long as its slide,
+		 * so memory does not depend on the number of payloads: closing a window combines all panes and reuses the oldest one
+		 */
+		struct WindowAggregator {
+			struct Pane {
+				uint64_t count;
+				double sum;
+				double min;
+				double max;
+			};
+
+			std::mutex mutex;
+			std::vector<Pane> panes;
+			size_t current;					// Pane receiving payloads
+			size_t accumulated;				// Panes of the window which have been accumulating, fewer than all at the beginning
+			std::vector<std::string> field;	// Split path of the aggregated field, empty to aggregate whole payloads
+			EventId output;
+			unsigned size;
+			unsigned slide;
+		};
+
+
+		/**
+		 * \brief Latency histograms recorded by a thread, one pair for each event and subscription it handled. Only the owner
+		 * thread adds histograms and records values, so recording takes no lock
+		 */
+		struct ThreadLatencies {
+			struct Histograms {
+				utils::LatencyHistogram queue;
+				utils::LatencyHistogram handler;
+			};
+
+			std::mutex mutex;		// Taken by the owner to add histograms and by readers
+			std::map<std::pair<EventId, SubscriptionId>, std::unique_ptr<Histograms>> histograms;
+		};
+
+
+		/**
+		 * \brief Latency histograms of a manager: those of the threads still recording and the merge of those of threads
+		 * which exited. Threads keep it by a weak pointer, to fold their histograms in it when they exit
+		 */
+		struct LatencyRecords {
+			std::mutex mutex;
+			std::vector<std::shared_ptr<ThreadLatencies>> threads;
+			std::map<std::pair<EventId, SubscriptionId>, LatencyStats> retired;
+		};
+
+
+		// Histograms of a thread for each manager it recorded for (defined in eventManager.cpp)
+		struct ThreadRecorders;
+
+
+		/**
+		 * \brief Token bucket of a rate limit, with its counters
+		 */
+		struct RateLimiter {
+			RateLimit limit;
+			utils::TokenBucket bucket;
+
+			std::atomic<uint64_t> admitted;
+			std::atomic<uint64_t> dropped;
+			std::atomic<uint64_t> delayed;
+
+			RateLimiter (RateLimit limit) : limit (limit), bucket (limit.rate, limit.burst), admitted (0), dropped (0), delayed (0) {}
+		};
+
+
+		/**
+		 * \brief Immutable description of an event and of its subscribers
+		 */
+		struct EventEntry {
+			std::string service;
+			std::string name;
+			bool registered;
+			EventOptions options;
+			std::vector<std::shared_ptr<Subscription>> subscribers;
+			std::shared_ptr<Subscription> responder;			// The only receiver of requests to this topic
+			std::shared_ptr<EventRuntime> runtime;
+			std::shared_ptr<RateLimiter> rateLimiter;			// Limit of the event
+			std::shared_ptr<RateLimiter> serviceRateLimiter;	// Limit shared by all events of the service
+		};
+
+
+		/**
+		 * \brief A service run by several instances, which make their subscriptions one replica at a time. The n-th
+		 * subscription of a replica to a route joins the group made by the n-th subscription of the first replica to it
+		 */
+		struct ReplicatedService {
+			ReplicaOptions options;
+			unsigned joining;			// Replica whose subscriptions are being made, "options.replicas" when none is joining
+			std::map<std::pair<std::string, unsigned>, unsigned> ordinals;		// Subscriptions of each route and replica
+			std::map<std::pair<std::string, unsigned>, std::shared_ptr<Subscription>> groups;	// By route and ordinal
+		};
+
+
+		/**
+		 * \brief A subscription made by a service being reloaded, attached to its event, pattern or endpoint only when
+		 * the reload completes
+		 */
+		struct StandbySubscription {
+			std::shared_ptr<Subscription> subscription;
+			EventId event;				// Unused by pattern subscriptions
+			bool responder;
+		};
+
+
+		/**
+		 * \brief Service name -> event name -> identifier
+		 */
+		typedef std::map<std::string, std::map<std::string, EventId>> EventNames;
+
+
+		/**
+		 * \brief Immutable snapshot of all events, indexed by their identifier. A writer copies it changing only the
+		 * entries it touches, and the copy shares all the others with the current snapshot
+		 */
+		struct EventTable {
+			utils::SharedVector<std::shared_ptr<const EventEntry>> events;
+			std::shared_ptr<const EventNames> names;
+			std::shared_ptr<utils::EventJournal> journal;
+		};
+
+
+		Engine &engine;
+
+		// Read without locks by "triggerEvent", replaced under "tableMutex" by all other operations
+		utils::SnapshotPointer<EventTable> eventTable;
+		std::mutex tableMutex;
+		std::map<std::string, unsigned> joinedServices;		// Joined instances of each service, two while it is reloaded
+		std::map<SubscriptionId, std::shared_ptr<Subscription>> subscriptions;
+		utils::TopicTrie<std::shared_ptr<Subscription>> patternSubscriptions;
+		SubscriptionId nextSubscriptionId;
+
+		// Reverse index used to cancel subscriptions of a leaving service without looking at the others
+		std::map<std::string, std::set<SubscriptionId>> ownedSubscriptions;
+
+		// Subscriptions made by the new instance of each service being reloaded
+		std::map<std::string, std::vector<StandbySubscription>> reloadingServices;
+
+		// Replicated services, with the subscriptions shared by their replicas
+		std::map<std::string, ReplicatedService> replicatedServices;
+
+		// Limits shared by all events of a service
+		std::map<std::string, std::shared_ptr<RateLimiter>> serviceRateLimiters;
+
+		// Latest payloads whose handler threw, the oldest discarded first
+		std::deque<DeadLetter> deadLetters;
+		std::mutex deadLettersMutex;
+
+		// Histograms of all threads which handled payloads while tracing, kept after they exit. Threads find theirs by
+		// the generation of the manager, unique among all managers built unlike their addresses
+		std::atomic<bool> latencyTracing;
+		const uint64_t generation;
+		std::shared_ptr<LatencyRecords> latencyRecords;
+
+		// Scheduled mailboxes, one lane for each EventPriority. The first dispatcher serves only the high priority lane
+		std::vector<std::thread> dispatchers;
+		std::deque<ReadyMailbox> readyMailboxes[3];
+		std::mutex deliveriesMutex;
+		std::condition_variable deliveriesCondition;
+		std::condition_variable highLaneCondition;
+		bool stopDispatchers;
+
+		// Deadlines of requests and ends of aggregation windows. Declared last, so its thread stops before timed callbacks
+		// could find other members destroyed
+		utils::TimerQueue timers;
+
+
+		/**
+		 * \brief Returns the identifier of "service/eventName", creating an unregistered entry if it does not exist.
+		 * Must be called with "tableMutex" held
+		 */
+		EventId internEvent (const std::string &service, const std::string &eventName);
+
+		/**
+		 * \brief Replaces the entry of event "id" with the result of "change". Must be called with "tableMutex" held
+		 */
+		void updateEntry (EventId id, std::function<void (EventEntry &)> change);
+
+		/**
+		 * \brief Returns the entry of "id" from "table", throwing if it does not exist
+		 */
+		static const EventEntry &getEntry (const EventTable &table, EventId id);
+
+		/**
+		 * \brief Body of dispatcher threads, which call handlers of triggered events. If "highLaneOnly" is true
+		 * only mailboxes scheduled with high priority are served, and only their high priority payloads are handled
+		 */
+		void dispatcherLoop (bool highLaneOnly);
+
+		/**
+		 * \brief Moves to "ready" the next mailbox to be served, returning false if there is none.
+		 * Must be called with "deliveriesMutex" held
+		 */
+		bool nextReadyMailbox (bool highLaneOnly, unsigned &turn, ReadyMailbox &ready);
+
+		/**
+		 * \brief Adds "subscription" to subscribers of "event" and returns its identifier
+		 */
+		SubscriptionId subscribe (EventId event, std::shared_ptr<Subscription> subscription);
+
+		/**
+		 * \brief Adds "subscription" to subscribers of all current and future events whose topic matches "pattern"
+		 */
+		SubscriptionId subscribePattern (std::string pattern, std::shared_ptr<Subscription> subscription);
+
+		/**
+		 * \brief Returns the topic of an event, "service/eventName"
+		 */
+		static std::string topicOf (const EventEntry &entry);
 
+		/**
+		 * \brief Returns what "subscription" receives: its pattern, "event" or the requests to endpoint "event"
+		 */
+		static std::string routeOf (const Subscription &subscription, EventId event, bool responder);
 
-	/**
-	 * \class TaskType
-	 * \brief Enum which define all possibe types of tasks
-	 */
-	enum class TaskType {None, OneShot, Timeout, Periodic};
+		/**
+		 * \brief Appends "count" objects of "event" to the mailbox of "subscription" applying its filter, conflation
+		 * and backpressure policy, and schedules the mailbox if it was idle. Objects of sticky events come with their
+		 * "sequences", so a payload older than the one delivered on subscription is skipped. A publisher reading the
+		 * table passes "deferred", where payloads for inline handlers and payloads which would make it wait are left
+		 * for "enqueueDeferred"
+		 */
+		void enqueue (const std::shared_ptr<Subscription> &subscription, EventId event, const EventOptions &eventOptions,
+					  const SharedEventObject *objects, const uint64_t *sequences, size_t count,
+					  std::vector<DeferredPayloads> *deferred);
 
+		/**
+		 * \brief Part of "enqueue" which follows the filter
+		 */
+		void enqueueAccepted (const std::shared_ptr<Subscription> &subscription, EventId event, const EventOptions &eventOptions,
+							  const SharedEventObject *objects, const uint64_t *sequences, size_t count,
+							  std::vector<DeferredPayloads> *deferred);
 
-	/**
-	 * \class TaskStatus
-	 * \brief Enum which represents status of current task
-	 */
-	enum class TaskStatus {Waiting, Running, Ended};
+		/**
+		 * \brief Enqueues or handles inline payloads left by "enqueue", in order. Must be called without reading the table
+		 */
+		void enqueueDeferred (std::vector<DeferredPayloads> &deferred);
 
+		/**
+		 * \brief Appends "object" to "mailbox" of "subscription", whose lock is "lock". Used by "enqueue". If the publisher
+		 * should wait for room but "mayWait" is false, nothing is changed and false is returned
+		 */
+		bool push (const std::shared_ptr<Subscription> &subscription, Mailbox &mailbox, std::unique_lock<std::mutex> &lock,
+				   EventId event, const EventOptions &eventOptions, const SharedEventObject &object, bool mayWait);
 
+		/**
+		 * \brief Returns the mailbox of "subscription" which receives "object", according to its partition key
+		 */
+		static Mailbox &mailboxOf (const Subscription &subscription, const SharedEventObject &object);
 
+		/**
+		 * \brief Checks options of "subscription" and creates its mailboxes
+		 */
+		void prepareSubscription (Subscription &subscription);
 
+		/**
+		 * \brief Adds "subscription" to subscriptions and to the index of its owner. Must be called with "tableMutex" held
+		 */
+		void indexSubscription (const std::shared_ptr<Subscription> &subscription);
 
+		/**
+		 * \brief Makes "subscription" the responder of "endpoint" and returns its identifier
+		 */
+		SubscriptionId subscribeResponder (EventId endpoint, std::shared_ptr<Subscription> subscription);
 
+		/**
+		 * \brief If the owner of "subscription" is replicated and the joining replica is not the first one, adds its
+		 * handlers to the group of the same route and ordinal, which replaces "subscription", and returns true. Otherwise
+		 * "subscription" gets a mailbox for each replica and stays paused until all replicas joined, if the owner is
+		 * replicated, and false is returned. Must be called with "tableMutex" held
+		 */
+		bool joinReplicas (std::shared_ptr<Subscription> &subscription, EventId event, bool responder);
 
+		/**
+		 * \brief Keeps "subscription" in standby if its owner is being reloaded, returning true. Otherwise it does nothing
+		 * and returns false. Must be called with "tableMutex" held
+		 */
+		bool holdSubscription (const std::shared_ptr<Subscription> &subscription, EventId event, bool responder);
 
-	/* ===================================================================================== */
-	/* ===================================================================================== */
+		/**
+		 * \brief Adds "standby" to its event, pattern or endpoint in "newTable", which is going to be published.
+		 * Must be called with "tableMutex" held
+		 */
+		void attachSubscription (EventTable &newTable, const StandbySubscription &standby);
 
+		/**
+		 * \brief Moves payloads left in mailboxes of "from" before those of mailboxes of "to", which must be paused.
+		 * Payloads of events "to" does not receive are dropped
+		 */
+		static void movePending (Subscription &from, Subscription &to);
 
+		/**
+		 * \brief Lets "subscription" be drained again, scheduling its mailboxes with payloads
+		 */
+		void resumeDelivery (const std::shared_ptr<Subscription> &subscription);
 
+		/**
+		 * \brief Removes "subscription" from entries of "newTable", which is going to be published, and from all indexes.
+		 * Must be called with "tableMutex" held
+		 */
+		void cancelSubscription (EventTable &newTable, std::shared_ptr<Subscription> subscription);
 
+		/**
+		 * \brief The two parts of "cancelSubscription": removing "subscription" from entries of "newTable", which may fail
+		 * and changes nothing else, and removing it from all indexes
+		 */
+		void detachSubscription (EventTable &newTable, const std::shared_ptr<Subscription> &subscription);
+		void forgetSubscription (const std::shared_ptr<Subscription> &subscription);
 
+		/**
+		 * \brief Delivers to "subscription" the cached payload of "event", if it is sticky
+		 */
+		void deliverLastValue (const std::shared_ptr<Subscription> &subscription, EventId event);
 
+		/**
+		 * \brief Makes "mailbox" of "subscription" available to dispatcher threads in the lane of "priority", replacing
+		 * entries made before. Must be called with the lock of "mailbox" held
+		 */
+		void schedule (const std::shared_ptr<Subscription> &subscription, Mailbox &mailbox, EventPriority priority);
 
+		/**
+		 * \brief Calls handlers of "subscription", those of "replica" if its owner is replicated, for all "objects" and
+		 * returns how many have been handled. A handler which throws has its payload stored among dead letters, and may
+		 * get the subscription suspended
+		 */
+		size_t deliver (Subscription &subscription, size_t replica, const PendingEvent *objects, size_t count);
 
-	/**
-	 * \class ServiceRegistry
-	 * \brief Its purpose is to keep track of loaded services and to run tasks when requested
-	 */
-	class ServiceRegistry : private Logger {
-	private :
-		// TODO
+		/**
+		 * \brief Calls the handler of inline "subscription" for "count" objects of "event" on this thread, moving the
+		 * subscription to dispatchers if it exceeds its time budget
+		 */
+		void deliverInline (Subscription &subscription, EventId event, const EventOptions &eventOptions,
+							const SharedEventObject *objects, size_t count);
 
+		/**
+		 * \brief Records latencies of a payload of "event" handled by "subscription" in the histograms of this thread.
+		 * Negative latencies are not recorded
+		 */
+		void recordLatency (EventId event, SubscriptionId subscription, int64_t queueLatency, int64_t handlerLatency);
 
-	protected :
+		/**
+		 * \brief Stores the exception being handled as the dead letter of "objects", counting the failure of "subscription"
+		 */
+		void handlerFailed (Subscription &subscription, const PendingEvent *objects, size_t count);
 
 		/**
-		 * \brief Function to start threads
+		 * \brief Returns true if "subscription" needs the json form of "object", to filter, partition or handle it
 		 */
-		void startRegistry ();
+		static bool needsJson (const Subscription &subscription, const EventObject &object);
 
 		/**
-		 * \brief Function to stop ServiceRegistry
+		 * \brief Throws if "object" has no json form while "entry" needs it, for its journal or one of its subscribers:
+		 * checked before delivering anything, so that no subscriber is left without the payload
 		 */
-		void stopRegistry ();
+		static void checkJson (const EventTable &table, const EventEntry &entry, const EventObject &object);
 
 		/**
-		 * \brief Return whether registry is started or not
+		 * \brief Delivers "object" to all subscribers of "event". If "admitted" is true, rate limits have already been applied
 		 */
-		bool isStarted ();
+		void dispatchEvent (EventId event, SharedEventObject object, bool admitted= false);
 
+		/**
+		 * \brief Delivers all "events" looking up the table once and enqueuing all payloads of an event to each subscriber at once
+		 */
+		void dispatchEvents (const std::vector<std::pair<EventId, SharedEventObject>> &events, bool admitted= false);
 
 		/**
-		 * \brief Loads a Service from shared object and insert it into service map
+		 * \brief Applies rate limits of "entry" to "count" payloads. Returns how many of them, from the first one, are
+		 * admitted; if the publisher has to wait for them, "delay" is raised to the time to wait
 		 */
-		void loadService	(std::string soPath, std::string name, int runLevel);
+		static size_t admit (const EventEntry &entry, size_t count, std::chrono::nanoseconds &delay);
 
 		/**
-		 * \brief Returns true if exists a service called "name", false otherwise
+		 * \brief Triggers the output of "aggregator" with the window closed at "deadline", then schedules the next one.
+		 * It stops when "subscription" is cancelled
 		 */
-		bool existsService	(std::string name);
+		void closeWindow (std::weak_ptr<Subscription> subscription, std::shared_ptr<WindowAggregator> aggregator,
+						  utils::TimerQueue::Clock::time_point deadline);
 
 		/**
-		 * \brief Unload Service with name "name", destroying it
+		 * \brief Checks "limit" and returns its limiter, or null if it does not limit anything
 		 */
-		void unloadService (std::string name);
+		static std::shared_ptr<RateLimiter> makeRateLimiter (const RateLimit &limit);
 
 		/**
-		 * \brief Returns the Service with this name
+		 * \brief Returns counters of "limiter", all zero if it is null
 		 */
-		Service &getService	(std::string name);
+		static RateLimitStats statsOf (const std::shared_ptr<RateLimiter> &limiter);
 
+		/**
+		 * \brief Appends "object" to the journal of "table" if "entry" is journaled. Returns true if a record was written,
+		 * storing its offset in "offset"
+		 */
+		static bool journalEvent (const EventTable &table, const EventEntry &entry, const SharedEventObject &object, uint64_t &offset);
 
-	public :
 
-		ServiceRegistry				(Engine &engine);
-		virtual ~ServiceRegistry	() = 0;
-	};
+	protected :
 
+		void serviceJoin (std::string serviceName);
+		void serviceLeave (std::string serviceName);
 
+		/**
+		 * \brief Starts the reload of "serviceName": its new instance may register again the events of the old one, and its
+		 * subscriptions are kept in standby, buffering nothing, until "swapSubscriptions"
+		 */
+		void holdSubscriptions	(std::string serviceName);
 
+		/**
+		 * \brief Stops delivering to subscriptions of the old instance of "serviceName", whose payloads are buffered in their
+		 * mailboxes, and waits for handlers already running, inline ones included
+		 */
+		void pauseSubscriptions	(std::string serviceName);
 
+		/**
+		 * \brief Ends the reload of "serviceName". If "commit" is true, subscriptions of the old instance are replaced by
+		 * the standby ones in a single table update, and buffered payloads are handed to them; otherwise standby
+		 * subscriptions are cancelled and the old ones are resumed. Returns the replaced subscriptions, which expire
+		 * once no dispatcher nor table refers to them
+		 */
+		std::vector<std::weak_ptr<const void>> swapSubscriptions	(std::string serviceName, bool commit);
 
+		/**
+		 * \brief Subscribes placeholders owned by "serviceName" to "events" (topics or patterns) and to its "endpoints".
+		 * Placeholders are never drained: they keep payloads until the service replaces them through a reload, and the
+		 * first payload they receive calls "activate" on the timer thread
+		 */
+		void armActivation		(std::string serviceName, std::vector<std::string> events, std::vector<std::string> endpoints,
+								 std::function<void ()> activate);
 
+		/**
+		 * \brief Returns the number of payloads received by subscriptions owned by "serviceName", placeholders excluded
+		 */
+		uint64_t getServiceActivity	(std::string serviceName);
 
+		/**
+		 * \brief Declares that "serviceName" runs "options.replicas" instances, which may join and register the same
+		 * events. Subscriptions of the instances with the same route share a subscription, with a mailbox for each
+		 * instance. Options with a single replica make the service not replicated anymore
+		 */
+		void setReplicas		(std::string serviceName, ReplicaOptions options);
 
-	/* ===================================================================================== */
-	/* ===================================================================================== */
+		/**
+		 * \brief Attributes the following subscriptions of replicated service "serviceName" to instance "replica".
+		 * Replicas join in order, starting from 0
+		 */
+		void joinReplica		(std::string serviceName, unsigned replica);
 
+		/**
+		 * \brief Ends the joining of the replicas of "serviceName", resuming the subscriptions they share. Throws if some
+		 * replica did not make all the subscriptions of the first one
+		 */
+		void completeReplicas	(std::string serviceName);
+
+		EventId registerEvent	(std::string serviceName, std::string eventName, EventOptions options= EventOptions ());
+		EventId getEventId		(std::string service, std::string eventName);
+
+		SubscriptionId onEvent	(EventId event, EventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(EventId event, SharedEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(EventId event, BatchEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(std::string service, std::string eventName, EventHandler handler,
+								 SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(std::string service, std::string eventName, SharedEventHandler handler,
+								 SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEventPattern	(std::string pattern, SharedEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEventPattern	(std::string pattern, PatternEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		std::string getEventTopic		(EventId event);
+		void triggerEvent	(EventId event, SharedPayload payload);
+		void triggerEvent	(EventId event, Json::Value &payload);
+		void triggerEvent	(EventId event, Json::Value &&payload);
+		void triggerEvent	(std::string service, std::string eventName, Json::Value &payload);
+		void triggerEvents	(EventId event, std::vector<SharedPayload> payloads);
+		void triggerEvents	(EventId event, std::vector<Json::Value> &payloads);
+		void triggerEvents	(std::vector<std::pair<EventId, SharedPayload>> events);
 
+		void unsubscribe		(SubscriptionId subscription);
+		SubscriptionStats getSubscriptionStats (SubscriptionId subscription);
 
+		/**
+		 * \brief Lets a subscription suspended by its failures receive payloads again
+		 */
+		void resumeSubscription	(SubscriptionId subscription);
 
+		/**
+		 * \brief Removes and returns stored dead letters, the oldest first
+		 */
+		std::vector<DeadLetter> takeDeadLetters ();
 
+		/**
+		 * \brief Starts or stops recording latencies of payloads. Tracing costs a few clock reads for each payload
+		 */
+		void setLatencyTracing	(bool enabled);
 
+		/**
+		 * \brief Merges histograms of all threads, returning latencies of each event and subscription, in this order
+		 */
+		std::vector<LatencyStats> getLatencyStats ();
 
+		/**
+		 * \brief Limits payloads triggered on all events of "service" together, in addition to limits of each event.
+		 * A limit with rate 0 removes the current one
+		 */
+		void setServiceRateLimit			(std::string service, RateLimit limit);
+		RateLimitStats getRateLimitStats	(EventId event);
+		RateLimitStats getServiceRateLimitStats	(std::string service);
 
-	/**
-	 * \class EventManager
-	 * \brief This class has the aim of register all throwable events by services with their subscriber and, when a service is fired, to call subscriber's callbacks
-	 */
-	class EventManager : private Logger {
-	private :
-		// TODO
+		void openJournal		(std::string directory, JournalOptions options= JournalOptions ());
+		uint64_t replayEvents	(uint64_t fromOffset, ReplayHandler handler);
 
+		/**
+		 * \brief Makes "handler" the responder of requests to "endpoint". Each endpoint has at most one responder
+		 */
+		SubscriptionId onRequest	(EventId endpoint, RequestHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onRequest	(std::string service, std::string endpointName, RequestHandler handler,
+									 SubscriptionOptions options= SubscriptionOptions ());
 
-	protected :
+		/**
+		 * \brief Hands "payload" to the responder of "endpoint", returning the future of its reply. If "timeout" milliseconds
+		 * elapse first, the future holds a RequestTimeoutException. Waiting for it inside a handler could use up dispatchers
+		 */
+		std::future<Json::Value> request	(EventId endpoint, SharedPayload payload, unsigned timeout= 0);
+		std::future<Json::Value> request	(EventId endpoint, Json::Value payload, unsigned timeout= 0);
+		std::future<Json::Value> request	(std::string service, std::string endpointName, Json::Value payload, unsigned timeout= 0);
 
-		void serviceJoin (std::string serviceName);
-		void serviceLeave (std::string serviceName);
+		/**
+		 * \brief Aggregates the numeric "field" of payloads of "event" (the payload itself if "field" is empty) over time
+		 * windows. The field is a path as in EventFilter, such as "position.x" or "items.0". At the end of each window with
+		 * some payloads, "output" is triggered with count, sum, min, max and mean of the field and with start and end of the
+		 * window, in milliseconds since epoch; the first sliding windows start with the aggregation. Payloads are accumulated
+		 * by their publishers and no handler is called for them, so "options.lastValue" is rejected. The timer thread
+		 * triggers "output" without ever waiting, so its full Block queues drop their oldest payloads. Cancelled by
+		 * "unsubscribe", like any subscription
+		 */
+		SubscriptionId aggregateEvent	(EventId event, std::string field, WindowOptions window, EventId output,
+										 SubscriptionOptions options= SubscriptionOptions ());
 
-		void registerEvent	(std::string serviceName, std::string eventName);
-		void onEvent		(std::string service, std::string eventName, EventHandler handler);
-		void triggerEvent	(std::string service, std::string eventName, Json::Value &payload);
+
+		/**
+		 * \brief Subscribes to "event" receiving its payload as an object of type T. Objects triggered with the same type
+		 * are handed over without any conversion, other payloads are converted through JsonConverter
+		 */
+		template <typename T>
+		SubscriptionId onTypedEvent (EventId event, TemplatedEventHandler<const T &> handler,
+									 SubscriptionOptions options= SubscriptionOptions ()) {
+			if (!handler)
+				throw exceptions::EventManagerException ("Empty handler for event " + std::to_string (event));
+
+			std::shared_ptr<Subscription> subscription	= std::make_shared<Subscription> ();
+			subscription->options						= options;
+			subscription->objectType					= &typeid (T);
+			subscription->handler						= [handler] (EventId, const SharedEventObject &object) {
+				if (object->type () == typeid (T))
+					handler (*static_cast<const T *> (object->get ()));
+				else
+					handler (JsonConverter<T>::fromJson (object->asJson ()));
+			};
+
+			return subscribe (event, subscription);
+		}
+
+
+		/**
+		 * \brief Triggers "event" with an object which is moved into the payload and never serialized,
+		 * unless a subscriber requests its json form. If T has no JsonConverter, triggering an event which is journaled
+		 * or has subscribers needing json (json handlers, handlers of another type, filters or partition keys) throws
+		 * without delivering the payload to anyone, and subscriptions needing json do not get it as last value
+		 */
+		template <typename T>
+		void triggerTypedEvent (EventId event, T &&value) {
+			typedef typename std::decay<T>::type ValueType;
+			dispatchEvent (event, std::make_shared<const TypedEventObject<ValueType>> (std::forward<T> (value)));
+		}
 
 
 	public :
@@ -258,19 +1668,94 @@ namespace microservicespp {
 		Json::Value &configuration;
 
 		void engineOn	();
+		std::vector<ServiceStartup> getStartupReport	();
+
+
+		EventId registerEvent	(Service &instance, std::string eventName, EventOptions options= EventOptions ());
+		EventId getEventId		(std::string triggerService, std::string eventName);
+
+		SubscriptionId onEvent	(EventId event, EventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(EventId event, SharedEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(EventId event, BatchEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(std::string triggerService, std::string eventName, EventHandler handler,
+								 SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(std::string triggerService, std::string eventName, SharedEventHandler handler,
+								 SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEventPattern	(std::string pattern, SharedEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEventPattern	(std::string pattern, PatternEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+
+		// Subscriptions of "instance", cancelled when it leaves. Those made without a service last until "unsubscribe"
+		SubscriptionId onEvent	(Service &instance, EventId event, EventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(Service &instance, EventId event, SharedEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(Service &instance, EventId event, BatchEventHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(Service &instance, std::string triggerService, std::string eventName, EventHandler handler,
+								 SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEvent	(Service &instance, std::string triggerService, std::string eventName, SharedEventHandler handler,
+								 SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEventPattern	(Service &instance, std::string pattern, SharedEventHandler handler,
+										 SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onEventPattern	(Service &instance, std::string pattern, PatternEventHandler handler,
+										 SubscriptionOptions options= SubscriptionOptions ());
+
+		std::string getEventTopic		(EventId event);
+		void triggerEvent	(EventId event, SharedPayload payload);
+		void triggerEvent	(EventId event, Json::Value &payload);
+		void triggerEvent	(Service &instance, std::string eventName, Json::Value &payload);
+		void triggerEvents	(EventId event, std::vector<Json::Value> &payloads);
+		void triggerEvents	(std::vector<std::pair<EventId, SharedPayload>> events);
+
+		void unsubscribe		(SubscriptionId subscription);
+		SubscriptionStats getSubscriptionStats (SubscriptionId subscription);
+		void resumeSubscription	(SubscriptionId subscription);
+		std::vector<DeadLetter> takeDeadLetters ();
+		void setLatencyTracing	(bool enabled);
+		std::vector<LatencyStats> getLatencyStats ();
+
+		void setServiceRateLimit			(std::string service, RateLimit limit);
+		RateLimitStats getRateLimitStats	(EventId event);
+		RateLimitStats getServiceRateLimitStats	(std::string service);
+
+		void openJournal		(std::string directory, JournalOptions options= JournalOptions ());
+		uint64_t replayEvents	(uint64_t fromOffset, ReplayHandler handler);
+
+		SubscriptionId onRequest	(EventId endpoint, RequestHandler handler, SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId onRequest	(Service &instance, std::string endpointName, RequestHandler handler,
+									 SubscriptionOptions options= SubscriptionOptions ());
+		std::future<Json::Value> request	(EventId endpoint, Json::Value payload, unsigned timeout= 0);
+		std::future<Json::Value> request	(std::string service, std::string endpointName, Json::Value payload, unsigned timeout= 0);
+
+		SubscriptionId aggregateEvent	(EventId event, std::string field, WindowOptions window, EventId output,
+										 SubscriptionOptions options= SubscriptionOptions ());
+		SubscriptionId aggregateEvent	(Service &instance, EventId event, std::string field, WindowOptions window, EventId output,
+										 SubscriptionOptions options= SubscriptionOptions ());
+
+
+		template <typename T>
+		SubscriptionId onTypedEvent (EventId event, TemplatedEventHandler<const T &> handler,
+									 SubscriptionOptions options= SubscriptionOptions ()) {
+			return EventManager::onTypedEvent<T> (event, handler, options);
+		}
 
+		template <typename T>
+		SubscriptionId onTypedEvent (Service &instance, EventId event, TemplatedEventHandler<const T &> handler,
+									 SubscriptionOptions options= SubscriptionOptions ());
 
-		void registerEvent	(Service &instance, std::string eventName) {
-			EventManager::registerEvent (instance.getName(), eventName);
+		template <typename T>
+		void triggerTypedEvent (EventId event, T &&value) {
+			EventManager::triggerTypedEvent (event, std::forward<T> (value));
 		}
 
-		void onEvent (std::string triggerService, std::string eventName, EventHandler handler) {
-			EventManager::onEvent (triggerService, eventName, handler);
-		}
 
-		void triggerEvent (Service &instance, std::string eventName, Json::Value &payload) {
-			EventManager::triggerEvent (instance.getName(), eventName, payload);
-		}
+	private :
+
+		void reloadBegin	(const std::string &name) override;
+		void reloadPause	(const std::string &name) override;
+		std::vector<std::weak_ptr<const void>> reloadEnd	(const std::string &name, bool commit) override;
+		void lazyArm		(const std::string &name, const LazyActivation &activation, std::function<void ()> activate) override;
+		uint64_t lazyActivity	(const std::string &name) override;
+		void replicateService	(const std::string &name, const ReplicaOptions &options) override;
+		void replicaBegin	(const std::string &name, unsigned replica) override;
+		void replicaEnd		(const std::string &name) override;
 	};
 
 
@@ -559,18 +2044,273 @@ namespace microservicespp {
 
 
 
-	/**
-	 * \class Logger
-	 * \brief Class to log messages with different log levels to an output stream
-	 */
-	class Logger {
-	private :
-		// TODO
+	inline std::vector<ServiceStartup> Engine::getStartupReport () {
+		return ServiceRegistry::getStartupReport ();
+	}
 
 
-	public :
-		// TODO
-	};
+	inline EventId Engine::registerEvent (Service &instance, std::string eventName, EventOptions options) {
+		return EventManager::registerEvent (instance.getName(), eventName, options);
+	}
+
+
+	inline EventId Engine::getEventId (std::string triggerService, std::string eventName) {
+		return EventManager::getEventId (triggerService, eventName);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (EventId event, EventHandler handler, SubscriptionOptions options) {
+		return EventManager::onEvent (event, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (EventId event, SharedEventHandler handler, SubscriptionOptions options) {
+		return EventManager::onEvent (event, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (EventId event, BatchEventHandler handler, SubscriptionOptions options) {
+		return EventManager::onEvent (event, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (std::string triggerService, std::string eventName, EventHandler handler,
+											SubscriptionOptions options) {
+		return EventManager::onEvent (triggerService, eventName, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (std::string triggerService, std::string eventName, SharedEventHandler handler,
+											SubscriptionOptions options) {
+		return EventManager::onEvent (triggerService, eventName, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEventPattern (std::string pattern, SharedEventHandler handler, SubscriptionOptions options) {
+		return EventManager::onEventPattern (pattern, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEventPattern (std::string pattern, PatternEventHandler handler, SubscriptionOptions options) {
+		return EventManager::onEventPattern (pattern, handler, options);
+	}
+
+
+	// Subscriptions of a service are cancelled when it leaves
+	inline SubscriptionId Engine::onEvent (Service &instance, EventId event, EventHandler handler, SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onEvent (event, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (Service &instance, EventId event, SharedEventHandler handler, SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onEvent (event, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (Service &instance, EventId event, BatchEventHandler handler, SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onEvent (event, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (Service &instance, std::string triggerService, std::string eventName, EventHandler handler,
+											SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onEvent (triggerService, eventName, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEvent (Service &instance, std::string triggerService, std::string eventName, SharedEventHandler handler,
+											SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onEvent (triggerService, eventName, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEventPattern (Service &instance, std::string pattern, SharedEventHandler handler,
+												  SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onEventPattern (pattern, handler, options);
+	}
+
+
+	inline SubscriptionId Engine::onEventPattern (Service &instance, std::string pattern, PatternEventHandler handler,
+												  SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onEventPattern (pattern, handler, options);
+	}
+
+
+	inline std::string Engine::getEventTopic (EventId event) {
+		return EventManager::getEventTopic (event);
+	}
+
+
+	inline void Engine::triggerEvent (EventId event, SharedPayload payload) {
+		EventManager::triggerEvent (event, payload);
+	}
+
+
+	inline void Engine::triggerEvent (EventId event, Json::Value &payload) {
+		EventManager::triggerEvent (event, payload);
+	}
+
+
+	inline void Engine::triggerEvent (Service &instance, std::string eventName, Json::Value &payload) {
+		EventManager::triggerEvent (instance.getName(), eventName, payload);
+	}
+
+
+	inline void Engine::triggerEvents (EventId event, std::vector<Json::Value> &payloads) {
+		EventManager::triggerEvents (event, payloads);
+	}
+
+
+	inline void Engine::triggerEvents (std::vector<std::pair<EventId, SharedPayload>> events) {
+		EventManager::triggerEvents (events);
+	}
+
+
+	inline void Engine::unsubscribe (SubscriptionId subscription) {
+		EventManager::unsubscribe (subscription);
+	}
+
+
+	inline SubscriptionStats Engine::getSubscriptionStats (SubscriptionId subscription) {
+		return EventManager::getSubscriptionStats (subscription);
+	}
+
+
+	inline void Engine::reloadBegin (const std::string &name) {
+		EventManager::holdSubscriptions (name);
+	}
+
+
+	inline void Engine::reloadPause (const std::string &name) {
+		EventManager::pauseSubscriptions (name);
+	}
+
+
+	inline std::vector<std::weak_ptr<const void>> Engine::reloadEnd (const std::string &name, bool commit) {
+		return EventManager::swapSubscriptions (name, commit);
+	}
+
+
+	inline void Engine::lazyArm (const std::string &name, const LazyActivation &activation, std::function<void ()> activate) {
+		EventManager::armActivation (name, activation.events, activation.endpoints, activate);
+	}
+
+
+	inline uint64_t Engine::lazyActivity (const std::string &name) {
+		return EventManager::getServiceActivity (name);
+	}
+
+
+	inline void Engine::replicateService (const std::string &name, const ReplicaOptions &options) {
+		EventManager::setReplicas (name, options);
+	}
+
+
+	inline void Engine::replicaBegin (const std::string &name, unsigned replica) {
+		EventManager::joinReplica (name, replica);
+	}
+
+
+	inline void Engine::replicaEnd (const std::string &name) {
+		EventManager::completeReplicas (name);
+	}
+
+
+	inline void Engine::resumeSubscription (SubscriptionId subscription) {
+		EventManager::resumeSubscription (subscription);
+	}
+
+
+	inline std::vector<DeadLetter> Engine::takeDeadLetters () {
+		return EventManager::takeDeadLetters ();
+	}
+
+
+	inline void Engine::setLatencyTracing (bool enabled) {
+		EventManager::setLatencyTracing (enabled);
+	}
+
+
+	inline std::vector<LatencyStats> Engine::getLatencyStats () {
+		return EventManager::getLatencyStats ();
+	}
+
+
+	inline void Engine::setServiceRateLimit (std::string service, RateLimit limit) {
+		EventManager::setServiceRateLimit (service, limit);
+	}
+
+
+	inline RateLimitStats Engine::getRateLimitStats (EventId event) {
+		return EventManager::getRateLimitStats (event);
+	}
+
+
+	inline RateLimitStats Engine::getServiceRateLimitStats (std::string service) {
+		return EventManager::getServiceRateLimitStats (service);
+	}
+
+
+	inline void Engine::openJournal (std::string directory, JournalOptions options) {
+		EventManager::openJournal (directory, options);
+	}
+
+
+	inline uint64_t Engine::replayEvents (uint64_t fromOffset, ReplayHandler handler) {
+		return EventManager::replayEvents (fromOffset, handler);
+	}
+
+
+	inline SubscriptionId Engine::onRequest (EventId endpoint, RequestHandler handler, SubscriptionOptions options) {
+		return EventManager::onRequest (endpoint, handler, options);
+	}
+
+
+	// Responders of a service are cancelled when it leaves
+	inline SubscriptionId Engine::onRequest (Service &instance, std::string endpointName, RequestHandler handler,
+											 SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onRequest (instance.getName (), endpointName, handler, options);
+	}
+
+
+	inline std::future<Json::Value> Engine::request (EventId endpoint, Json::Value payload, unsigned timeout) {
+		return EventManager::request (endpoint, std::move (payload), timeout);
+	}
+
+
+	inline std::future<Json::Value> Engine::request (std::string service, std::string endpointName, Json::Value payload,
+													 unsigned timeout) {
+		return EventManager::request (service, endpointName, std::move (payload), timeout);
+	}
+
+
+	inline SubscriptionId Engine::aggregateEvent (EventId event, std::string field, WindowOptions window, EventId output,
+												  SubscriptionOptions options) {
+		return EventManager::aggregateEvent (event, field, window, output, options);
+	}
+
+
+	inline SubscriptionId Engine::aggregateEvent (Service &instance, EventId event, std::string field, WindowOptions window, EventId output,
+												  SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::aggregateEvent (event, field, window, output, options);
+	}
+
+
+	template <typename T>
+	inline SubscriptionId Engine::onTypedEvent (Service &instance, EventId event, TemplatedEventHandler<const T &> handler,
+												SubscriptionOptions options) {
+		options.owner	= instance.getName ();
+		return EventManager::onTypedEvent<T> (event, handler, options);
+	}
 } // namespace microservicespp
 
 
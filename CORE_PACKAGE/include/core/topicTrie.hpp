@@ -0,0 +1,203 @@
+/**
+ * \file topicTrie.hpp
+ * \author Luca Di Mauro
+ * \brief Implementation of class TopicTrie
+ */
+
+
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+#include <core/exceptions.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+
+namespace microservicespp {
+	namespace utils {
+
+		/**
+		 * \class TopicTrie
+		 * \brief Trie of topic patterns, each one associated to some values.
+		 * Topics are sequences of segments separated by '/'. In patterns, segment "*" matches exactly one segment and
+		 * segment "**", allowed only at the end, matches any number of remaining segments (also none).
+		 * Matching a topic visits only nodes of patterns which match a prefix of it: with literal patterns this is
+		 * O(topic depth) regardless of their number, but since both the literal child and "*" are followed at each
+		 * level, the worst case (e.g. all combinations of literals and "*" stored) is O(2^depth).
+		 */
+		template <class V>
+		class TopicTrie {
+		private :
+
+			struct Node {
+				std::map<std::string, std::unique_ptr<Node>> children;
+				std::unique_ptr<Node> anySegment;		// Child reached by "*"
+				std::vector<V> values;					// Values of patterns ending here
+				std::vector<V> tailValues;				// Values of patterns ending here with "**"
+			};
+
+			Node root;
+
+
+			static void checkPattern (const std::vector<std::string> &segments) {
+				for (size_t i=0; i<segments.size (); i++) {
+					if (segments[i] == "**" && i != segments.size () - 1)
+						throw exceptions::EventManagerException ("Segment \"**\" is allowed only at the end of a pattern");
+				}
+			}
+
+
+			static void collect (const Node &node, const std::vector<std::string> &segments, size_t depth, std::vector<V> &result) {
+				result.insert (result.end (), node.tailValues.begin (), node.tailValues.end ());
+
+				if (depth == segments.size ()) {
+					result.insert (result.end (), node.values.begin (), node.values.end ());
+					return;
+				}
+
+				auto childIt	= node.children.find (segments[depth]);
+				if (childIt != node.children.end ())
+					collect (*childIt->second, segments, depth+1, result);
+
+				if (node.anySegment)
+					collect (*node.anySegment, segments, depth+1, result);
+			}
+
+
+			static bool prune (Node &node, const std::vector<std::string> &segments, size_t depth, const V &value) {
+				bool removed	= false;
+
+				if (depth == segments.size ()) {
+					auto it	= std::find (node.values.begin (), node.values.end (), value);
+					if (it != node.values.end ()) {
+						node.values.erase (it);
+						removed	= true;
+					}
+				}
+				else if (segments[depth] == "**") {
+					auto it	= std::find (node.tailValues.begin (), node.tailValues.end (), value);
+					if (it != node.tailValues.end ()) {
+						node.tailValues.erase (it);
+						removed	= true;
+					}
+				}
+				else if (segments[depth] == "*") {
+					if (node.anySegment && (removed = prune (*node.anySegment, segments, depth+1, value)) && isEmpty (*node.anySegment))
+						node.anySegment.reset ();
+				}
+				else {
+					auto childIt	= node.children.find (segments[depth]);
+					if (childIt != node.children.end () && (removed = prune (*childIt->second, segments, depth+1, value)) &&
+						isEmpty (*childIt->second))
+						node.children.erase (childIt);
+				}
+
+				return removed;
+			}
+
+
+			static bool isEmpty (const Node &node) {
+				return node.children.empty () && !node.anySegment && node.values.empty () && node.tailValues.empty ();
+			}
+
+
+		public :
+
+			/**
+			 * \brief Splits "topic" in its segments
+			 */
+			static std::vector<std::string> split (const std::string &topic) {
+				std::vector<std::string> segments;
+				size_t begin	= 0;
+
+				while (true) {
+					size_t end	= topic.find ('/', begin);
+					segments.push_back (topic.substr (begin, end - begin));
+					if (end == std::string::npos)
+						return segments;
+					begin	= end + 1;
+				}
+			}
+
+
+			/**
+			 * \brief Throws an EventManagerException if "pattern" is not a valid pattern
+			 */
+			static void validate (const std::string &pattern) {
+				checkPattern (split (pattern));
+			}
+
+
+			/**
+			 * \brief Returns true if "topic" is matched by "pattern"
+			 */
+			static bool matches (const std::string &pattern, const std::string &topic) {
+				std::vector<std::string> patternSegments	= split (pattern);
+				std::vector<std::string> topicSegments		= split (topic);
+				checkPattern (patternSegments);
+
+				for (size_t i=0; i<patternSegments.size (); i++) {
+					if (patternSegments[i] == "**")
+						return true;
+					if (i == topicSegments.size ())
+						return false;
+					if (patternSegments[i] != "*" && patternSegments[i] != topicSegments[i])
+						return false;
+				}
+
+				return patternSegments.size () == topicSegments.size ();
+			}
+
+
+			/**
+			 * \brief Associates "value" to "pattern"
+			 */
+			void insert (const std::string &pattern, const V &value) {
+				std::vector<std::string> segments	= split (pattern);
+				checkPattern (segments);
+
+				Node *node	= &root;
+				for (auto &segment : segments) {
+					if (segment == "**") {
+						node->tailValues.push_back (value);
+						return;
+					}
+
+					std::unique_ptr<Node> &child	= (segment == "*") ? node->anySegment : node->children[segment];
+					if (!child)
+						child.reset (new Node ());
+					node	= child.get ();
+				}
+
+				node->values.push_back (value);
+			}
+
+
+			/**
+			 * \brief Removes association between "value" and "pattern". Returns false if it does not exist
+			 */
+			bool remove (const std::string &pattern, const V &value) {
+				std::vector<std::string> segments	= split (pattern);
+				checkPattern (segments);
+
+				return prune (root, segments, 0, value);
+			}
+
+
+			/**
+			 * \brief Appends to "result" values of all patterns matching "topic"
+			 */
+			void match (const std::string &topic, std::vector<V> &result) const {
+				collect (root, split (topic), 0, result);
+			}
+		};
+
+	} // namespace utils
+} // namespace microservicespp
+
+
+#endif
@@ -0,0 +1,655 @@
+/**
+ * \file utils.hpp
+ * \author Luca Di Mauro
+ * \brief Header file for utility classes shared by core classes
+ */
+
+
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+
+namespace microservicespp {
+	namespace utils {
+
+		/**
+		 * \class SnapshotPointer
+		 * \brief Pointer to an immutable object which is read without locks and replaced by writers (RCU-like).
+		 * Readers announce themselves on one of two epoch counters; a writer publishes the new object, flips the epoch
+		 * and waits until the old epoch is drained before destroying the previous object. Counters are split in shards,
+		 * each taken by some threads, so readers on different cores do not write the same cache line.
+		 * Writers must be serialized by the caller.
+		 */
+		template <class T>
+		class SnapshotPointer {
+		private :
+
+			static const size_t readerShards	= 32;
+			static const size_t cacheLineSize	= 64;
+
+			// Counters have almost a cache line of padding on each side, so whatever the alignment of the pointer
+			// the lines they lie on hold nothing else
+			struct ReaderShard {
+				char before[cacheLineSize - alignof (std::atomic<unsigned long>)];
+				std::atomic<unsigned long> readers[2];
+				char after[cacheLineSize - alignof (std::atomic<unsigned long>)];
+			};
+
+			std::atomic<const T *> current;
+			std::atomic<unsigned> epoch;
+			mutable ReaderShard shards[readerShards];
+
+
+			/**
+			 * \brief Returns the shard of the calling thread. Threads take shards in turn, so they share one only when
+			 * they are more than the shards
+			 */
+			ReaderShard &shardOfThread () const {
+				static std::atomic<size_t> nextShard (0);
+				static thread_local size_t shard	= nextShard++ % readerShards;
+
+				return shards[shard];
+			}
+
+
+			/**
+			 * \brief Waits until all readers which could have seen the old object have finished
+			 */
+			void synchronize () {
+				unsigned oldEpoch	= epoch.load ();
+				epoch.store (oldEpoch ^ 1);
+
+				// A reader registered on a shard already visited rechecks the epoch, so it never reads the old object
+				for (auto &shard : shards) {
+					while (shard.readers[oldEpoch].load () != 0)
+						std::this_thread::yield ();
+				}
+			}
+
+
+		public :
+
+			/**
+			 * \class ReadGuard
+			 * \brief Keeps the snapshot alive while in scope
+			 */
+			class ReadGuard {
+			private :
+				std::atomic<unsigned long> *counter;
+				const T *snapshot;
+
+			public :
+				ReadGuard (std::atomic<unsigned long> *counter, const T *snapshot) : counter (counter), snapshot (snapshot) {}
+
+				ReadGuard (ReadGuard &&other) : counter (other.counter), snapshot (other.snapshot) {
+					other.counter	= nullptr;
+				}
+
+				ReadGuard (const ReadGuard &)				= delete;
+				ReadGuard &operator= (const ReadGuard &)	= delete;
+
+				~ReadGuard () {
+					if (counter)
+						counter->fetch_sub (1);
+				}
+
+				const T *operator-> () const	{ return snapshot; }
+				const T &operator* () const		{ return *snapshot; }
+			};
+
+
+			SnapshotPointer (const T *initial) : current (initial), epoch (0) {
+				for (auto &shard : shards) {
+					shard.readers[0]	= 0;
+					shard.readers[1]	= 0;
+				}
+			}
+
+			~SnapshotPointer () {
+				delete (current.load ());
+			}
+
+			SnapshotPointer (const SnapshotPointer &)				= delete;
+			SnapshotPointer &operator= (const SnapshotPointer &)	= delete;
+
+
+			/**
+			 * \brief Returns a guard to current snapshot. It never blocks
+			 */
+			ReadGuard read () const {
+				ReaderShard &shard	= shardOfThread ();
+
+				while (true) {
+					unsigned e	= epoch.load ();
+					shard.readers[e].fetch_add (1);
+
+					// A writer flipped the epoch meanwhile: register again on the new one
+					if (epoch.load () == e)
+						return ReadGuard (&shard.readers[e], current.load ());
+
+					shard.readers[e].fetch_sub (1);
+				}
+			}
+
+
+			/**
+			 * \brief Returns current snapshot without protection. Only writers may call it
+			 */
+			const T *get () const {
+				return current.load ();
+			}
+
+
+			/**
+			 * \brief Replaces current snapshot with "next", destroying the previous one when no reader can access it
+			 */
+			void publish (const T *next) {
+				const T *previous	= current.exchange (next);
+				synchronize ();
+				delete (previous);
+			}
+		};
+
+
+
+
+		/**
+		 * \class TimerQueue
+		 * \brief Runs callbacks at their deadlines on a single thread. Callbacks must be short, since they delay each other
+		 */
+		class TimerQueue {
+		public :
+
+			typedef std::chrono::steady_clock Clock;
+
+
+		private :
+
+			std::multimap<Clock::time_point, std::function<void ()>> timers;
+			std::mutex mutex;
+			std::condition_variable condition;
+			bool stop;
+			std::thread worker;
+
+
+			void loop () {
+				std::unique_lock<std::mutex> lock (mutex);
+
+				while (!stop) {
+					if (timers.empty ()) {
+						condition.wait (lock);
+						continue;
+					}
+
+					auto first	= timers.begin ();
+					if (first->first > Clock::now ()) {
+						condition.wait_until (lock, first->first);
+						continue;
+					}
+
+					std::function<void ()> callback	= std::move (first->second);
+					timers.erase (first);
+
+					lock.unlock ();
+					callback ();
+					lock.lock ();
+				}
+			}
+
+
+		public :
+
+			TimerQueue () : stop (false), worker (&TimerQueue::loop, this) {}
+
+			~TimerQueue () {
+				{
+					std::unique_lock<std::mutex> lock (mutex);
+					stop	= true;
+				}
+				condition.notify_one ();
+				worker.join ();
+			}
+
+			TimerQueue (const TimerQueue &)				= delete;
+			TimerQueue &operator= (const TimerQueue &)	= delete;
+
+
+			/**
+			 * \brief Runs "callback" at "deadline". Callbacks not run yet when the queue is destroyed are discarded
+			 */
+			void schedule (Clock::time_point deadline, std::function<void ()> callback) {
+				bool earliest;
+				{
+					std::unique_lock<std::mutex> lock (mutex);
+					earliest	= timers.empty () || deadline < timers.begin ()->first;
+					timers.emplace (deadline, std::move (callback));
+				}
+
+				// Only a new earliest deadline changes how long the worker has to wait
+				if (earliest)
+					condition.notify_one ();
+			}
+		};
+
+
+
+
+		/**
+		 * \brief Returns nanoseconds of TimerQueue::Clock, the time unit of TokenBucket and LatencyHistogram
+		 */
+		inline int64_t steadyNanoseconds () {
+			return std::chrono::duration_cast<std::chrono::nanoseconds> (TimerQueue::Clock::now ().time_since_epoch ()).count ();
+		}
+
+
+
+
+		/**
+		 * \class TokenBucket
+		 * \brief Lock-free token bucket, implemented as a generic cell rate algorithm: instead of counting tokens it keeps
+		 * the theoretical arrival time of the next token, so a single compare-and-swap takes tokens and refills the bucket.
+		 * Times are given by "steadyNanoseconds"
+		 */
+		class TokenBucket {
+		private :
+
+			std::atomic<int64_t> theoreticalArrival;
+			const int64_t interval;			// Nanoseconds needed to produce a token
+			const int64_t burstWindow;		// Time covered by a full bucket
+
+
+			// Time needed to produce "tokens", saturated to "maxWindow" so that it cannot overflow
+			int64_t cost (unsigned tokens) const {
+				return (tokens > maxWindow / interval) ? maxWindow : interval * tokens;
+			}
+
+
+		public :
+
+			// Longest time covered by a full bucket, about 52 days: times stay far from overflowing int64_t
+			static const int64_t maxWindow	= int64_t (1) << 52;
+
+
+			/**
+			 * \brief Returns true if a bucket can produce "rate" tokens per second, up to "burst" at once: "rate" must give
+			 * at least one nanosecond per token and "burst" tokens must not take longer than "maxWindow"
+			 */
+			static bool isValid (double rate, unsigned burst) {
+				return rate > 0 && rate <= 1e9 && burst > 0 && 1e9 / rate * burst <= maxWindow;
+			}
+
+
+			/**
+			 * \brief Builds a bucket which is initially full. "rate" and "burst" have to be valid for "isValid"
+			 */
+			TokenBucket (double rate, unsigned burst) : theoreticalArrival (0),
+														interval (static_cast<int64_t> (1e9 / rate)),
+														burstWindow (interval * burst) {}
+
+			TokenBucket (const TokenBucket &)				= delete;
+			TokenBucket &operator= (const TokenBucket &)	= delete;
+
+
+			/**
+			 * \brief Takes "tokens" if they are available at "time". Otherwise nothing is taken and false is returned
+			 */
+			bool tryAcquire (int64_t time, unsigned tokens= 1) {
+				int64_t arrival	= theoreticalArrival.load ();
+
+				while (true) {
+					int64_t next	= std::max (arrival, time) + cost (tokens);
+					if (next - time > burstWindow)
+						return false;
+					if (theoreticalArrival.compare_exchange_weak (arrival, next))
+						return true;
+				}
+			}
+
+
+			/**
+			 * \brief Takes "tokens" in any case, returning how many nanoseconds after "time" they will be available
+			 */
+			int64_t reserve (int64_t time, unsigned tokens= 1) {
+				int64_t arrival	= theoreticalArrival.load ();
+
+				while (true) {
+					int64_t next	= std::max (arrival, time) + cost (tokens);
+					if (theoreticalArrival.compare_exchange_weak (arrival, next))
+						return std::max<int64_t> (0, next - time - burstWindow);
+				}
+			}
+
+
+			/**
+			 * \brief Gives back "tokens" taken and then not used
+			 */
+			void refund (unsigned tokens) {
+				theoreticalArrival	-= cost (tokens);
+			}
+		};
+
+
+
+
+		/**
+		 * \class LatencyHistogram
+		 * \brief Histogram of durations in nanoseconds with buckets of logarithmic size (as HDR histograms), so each value
+		 * is recorded with a relative error below 1/16 in constant memory. Values above about 18 minutes fall in the last
+		 * bucket. Only one thread may record values, while any thread may copy the histogram at the same time
+		 */
+		class LatencyHistogram {
+		public :
+
+			static const unsigned subBucketBits	= 4;
+			static const unsigned maxExponent	= 40;
+			static const size_t subBuckets		= size_t (1) << subBucketBits;
+			static const size_t bucketsNumber	= (maxExponent - subBucketBits + 2) * subBuckets;
+
+
+		private :
+
+			std::atomic<uint64_t> counts[bucketsNumber];
+			std::atomic<uint64_t> total;
+			std::atomic<uint64_t> sum;
+			std::atomic<uint64_t> maximum;
+
+
+			// Values below "subBuckets" have a bucket each, then each power of two is split in "subBuckets" buckets
+			static size_t indexOf (uint64_t value) {
+				if (value < subBuckets)
+					return value;
+
+				unsigned shift	= 63 - __builtin_clzll (value) - subBucketBits;
+				size_t index	= (shift + 1) * subBuckets + ((value >> shift) - subBuckets);
+
+				return std::min (index, bucketsNumber - 1);
+			}
+
+
+			// Lowest value of bucket "index"
+			static uint64_t lowestOf (size_t index) {
+				if (index < subBuckets)
+					return index;
+
+				return (index % subBuckets + subBuckets) << (index / subBuckets - 1);
+			}
+
+
+			// A single writer needs no read-modify-write: readers only have to see whole values
+			static void add (std::atomic<uint64_t> &counter, uint64_t value) {
+				counter.store (counter.load (std::memory_order_relaxed) + value, std::memory_order_relaxed);
+			}
+
+
+		public :
+
+			LatencyHistogram () : total (0), sum (0), maximum (0) {
+				for (auto &counter : counts)
+					counter.store (0, std::memory_order_relaxed);
+			}
+
+			LatencyHistogram (const LatencyHistogram &other) : LatencyHistogram () {
+				merge (other);
+			}
+
+			LatencyHistogram &operator= (const LatencyHistogram &other) {
+				if (this != &other) {
+					reset ();
+					merge (other);
+				}
+				return *this;
+			}
+
+
+			/**
+			 * \brief Records "value" nanoseconds. Only the owner thread may call it
+			 */
+			void record (uint64_t value) {
+				add (counts[indexOf (value)], 1);
+				add (total, 1);
+				add (sum, value);
+				if (value > maximum.load (std::memory_order_relaxed))
+					maximum.store (value, std::memory_order_relaxed);
+			}
+
+
+			/**
+			 * \brief Adds values of "other" to this histogram, which must not be recorded meanwhile
+			 */
+			void merge (const LatencyHistogram &other) {
+				for (size_t i=0; i<bucketsNumber; i++)
+					add (counts[i], other.counts[i].load (std::memory_order_relaxed));
+				add (total, other.total.load (std::memory_order_relaxed));
+				add (sum, other.sum.load (std::memory_order_relaxed));
+				maximum.store (std::max (maximum.load (std::memory_order_relaxed), other.maximum.load (std::memory_order_relaxed)),
+							   std::memory_order_relaxed);
+			}
+
+
+			void reset () {
+				for (auto &counter : counts)
+					counter.store (0, std::memory_order_relaxed);
+				total.store (0, std::memory_order_relaxed);
+				sum.store (0, std::memory_order_relaxed);
+				maximum.store (0, std::memory_order_relaxed);
+			}
+
+
+			uint64_t count () const	{ return total.load (std::memory_order_relaxed); }
+			uint64_t max () const	{ return maximum.load (std::memory_order_relaxed); }
+
+			double mean () const {
+				uint64_t n	= count ();
+				return n == 0 ? 0 : static_cast<double> (sum.load (std::memory_order_relaxed)) / n;
+			}
+
+
+			/**
+			 * \brief Returns the value below which "percentage" percent of recorded values fall, as the highest value of
+			 * its bucket. Returns 0 if nothing has been recorded
+			 */
+			uint64_t percentile (double percentage) const {
+				uint64_t n	= count ();
+				if (n == 0)
+					return 0;
+
+				uint64_t rank	= static_cast<uint64_t> (percentage / 100 * n + 0.5);
+				rank			= std::max<uint64_t> (1, std::min (rank, n));
+
+				uint64_t seen	= 0;
+				for (size_t i=0; i<bucketsNumber; i++) {
+					seen	+= counts[i].load (std::memory_order_relaxed);
+					if (seen >= rank)
+						return i + 1 < bucketsNumber ? std::min (lowestOf (i + 1) - 1, max ()) : max ();
+				}
+
+				return max ();
+			}
+		};
+
+
+
+
+
+		/**
+		 * \class FrozenStringMap
+		 * \brief Immutable map from strings, stored as an open addressing table with linear probing. Hashes of keys are
+		 * kept in the table, so a lookup compares strings only when hashes match, and lookups of keys given as
+		 * characters never allocate. Meant to be rebuilt on each change and read through a SnapshotPointer
+		 */
+		template <class V>
+		class FrozenStringMap {
+		private :
+
+			struct Slot {
+				uint64_t hash;
+				std::string key;
+				V value;
+				bool used;
+			};
+
+			std::vector<Slot> slots;		// Size is a power of two at least twice the number of keys
+			size_t mask;
+			size_t keys;
+
+
+		public :
+
+			// FNV-1a
+			static uint64_t hashOf (const char *key, size_t length) {
+				uint64_t hash	= 14695981039346656037ull;
+				for (size_t i=0; i<length; i++) {
+					hash	^= static_cast<unsigned char> (key[i]);
+					hash	*= 1099511628211ull;
+				}
+				return hash;
+			}
+
+
+			/**
+			 * \brief Builds the table from "entries". Of two entries with the same key, the last one is kept
+			 */
+			FrozenStringMap (const std::vector<std::pair<std::string, V>> &entries= std::vector<std::pair<std::string, V>> ()) : keys (0) {
+				size_t capacity	= 2;
+				while (capacity < entries.size () * 2)
+					capacity	*= 2;
+
+				slots.resize (capacity, Slot {0, std::string (), V (), false});
+				mask	= capacity - 1;
+
+				for (auto &entry : entries) {
+					uint64_t hash	= hashOf (entry.first.data (), entry.first.size ());
+					size_t index	= hash & mask;
+					while (slots[index].used && slots[index].key != entry.first)
+						index	= (index + 1) & mask;
+
+					if (!slots[index].used)
+						keys++;
+					slots[index]	= Slot {hash, entry.first, entry.second, true};
+				}
+			}
+
+
+			/**
+			 * \brief Returns the value of "key", or nullptr if it is missing
+			 */
+			const V *find (const char *key, size_t length) const {
+				uint64_t hash	= hashOf (key, length);
+
+				// Tables are never full, so an empty slot always ends the probe
+				for (size_t index=hash & mask; slots[index].used; index=(index + 1) & mask) {
+					const Slot &slot	= slots[index];
+					if (slot.hash == hash && slot.key.size () == length && memcmp (slot.key.data (), key, length) == 0)
+						return &slot.value;
+				}
+
+				return nullptr;
+			}
+
+			const V *find (const char *key) const			{ return find (key, strlen (key)); }
+			const V *find (const std::string &key) const	{ return find (key.data (), key.size ()); }
+
+			size_t size () const	{ return keys; }
+		};
+
+
+
+
+		/**
+		 * \class SharedVector
+		 * \brief Vector whose copies share their storage: elements are kept in the leaves of a tree of nodes with 32
+		 * children, and changing an element of a copy copies only the nodes on its path which are shared with other
+		 * copies. So copying costs O(1) and changing k elements O(k log32 n), while reading an element follows
+		 * log32 n nodes. A copy is changed by a thread at a time, and read by any thread once it is not changed anymore
+		 */
+		template <class T>
+		class SharedVector {
+		private :
+
+			static const unsigned nodeBits	= 5;
+			static const size_t nodeSize	= size_t (1) << nodeBits;
+			static const size_t nodeMask	= nodeSize - 1;
+
+			struct Node {
+				std::shared_ptr<Node> children[nodeSize];		// Used by inner nodes
+				T values[nodeSize];								// Used by leaves
+			};
+
+			std::shared_ptr<Node> root;
+			size_t elements;
+			unsigned shift;										// Bits of an index above those of its leaf
+
+
+			// Returns "node" after making it owned by this vector only, copying it if it is shared
+			static Node *own (std::shared_ptr<Node> &node) {
+				if (!node)
+					node	= std::make_shared<Node> ();
+				else if (node.use_count () > 1)
+					node	= std::make_shared<Node> (*node);
+
+				return node.get ();
+			}
+
+
+		public :
+
+			SharedVector () : elements (0), shift (0) {}
+
+
+			size_t size () const	{ return elements; }
+
+
+			const T &operator[] (size_t index) const {
+				const Node *node	= root.get ();
+				for (unsigned level=shift; level>0; level-=nodeBits)
+					node	= node->children[(index >> level) & nodeMask].get ();
+
+				return node->values[index & nodeMask];
+			}
+
+
+			/**
+			 * \brief Replaces element "index", which must exist
+			 */
+			void set (size_t index, T value) {
+				Node *node	= own (root);
+				for (unsigned level=shift; level>0; level-=nodeBits)
+					node	= own (node->children[(index >> level) & nodeMask]);
+
+				node->values[index & nodeMask]	= std::move (value);
+			}
+
+
+			void push_back (T value) {
+				// A full tree becomes the first child of a new root
+				if (root && elements == (nodeSize << shift)) {
+					std::shared_ptr<Node> newRoot	= std::make_shared<Node> ();
+					newRoot->children[0]			= root;
+					root							= newRoot;
+					shift							+= nodeBits;
+				}
+
+				set (elements++, std::move (value));
+			}
+		};
+
+	} // namespace utils
+} // namespace microservicespp
+
+
+#endif
@@ -0,0 +1,19 @@
+/**
+ * \file engine.cpp
+ * \author Luca Di Mauro
+ * \brief Implementation of class Engine
+ */
+
+
+#include <core/microservicespp.hpp>
+
+using namespace microservicespp;
+
+
+
+
+// Services are stopped while the hooks they may call are still there. Defined here, out of line, so that the vtable of
+// Engine is emitted only by this file
+Engine::~Engine () {
+	ServiceRegistry::stopRegistry ();
+}
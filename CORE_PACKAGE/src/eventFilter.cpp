@@ -0,0 +1,246 @@
+/**
+ * \file eventFilter.cpp
+ * \author Luca Di Mauro
+ * \brief Implementation of class EventFilter
+ */
+
+
+#include <core/eventFilter.hpp>
+#include <core/exceptions.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace microservicespp;
+
+
+
+
+EventFilter EventFilter::where (std::string path, FilterOperator comparison, Json::Value operand) {
+	if (path.empty ())
+		throw exceptions::EventManagerException ("Empty field path in event filter");
+
+	Instruction instruction;
+	instruction.type		= InstructionType::Compare;
+	instruction.span		= 1;
+	instruction.comparison	= comparison;
+	instruction.operand		= operand;
+	instruction.path		= splitPath (path);
+
+	EventFilter filter;
+	filter.program.push_back (instruction);
+
+	return filter;
+}
+
+
+
+
+EventFilter EventFilter::combine (const EventFilter &other, InstructionType type) const {
+	// An empty filter matches everything: it is neutral for "&&" and absorbing for "||"
+	if (program.empty ())
+		return (type == InstructionType::And) ? other : *this;
+	if (other.program.empty ())
+		return (type == InstructionType::And) ? *this : other;
+
+	EventFilter filter;
+	filter.program	= program;
+	filter.program.insert (filter.program.end (), other.program.begin (), other.program.end ());
+
+	Instruction instruction;
+	instruction.type	= type;
+	instruction.span	= program.size () + other.program.size () + 1;
+	filter.program.push_back (instruction);
+
+	return filter;
+}
+
+
+
+
+EventFilter EventFilter::operator&& (const EventFilter &other) const {
+	return combine (other, InstructionType::And);
+}
+
+
+
+
+EventFilter EventFilter::operator|| (const EventFilter &other) const {
+	return combine (other, InstructionType::Or);
+}
+
+
+
+
+EventFilter EventFilter::operator! () const {
+	if (program.empty ())
+		throw exceptions::EventManagerException ("Negation of an empty event filter");
+
+	EventFilter filter	= *this;
+
+	Instruction instruction;
+	instruction.type	= InstructionType::Not;
+	instruction.span	= program.size () + 1;
+	filter.program.push_back (instruction);
+
+	return filter;
+}
+
+
+
+
+bool EventFilter::operator== (const EventFilter &other) const {
+	if (program.size () != other.program.size ())
+		return false;
+
+	for (size_t i=0; i<program.size (); i++) {
+		const Instruction &mine		= program[i];
+		const Instruction &theirs	= other.program[i];
+
+		if (mine.type != theirs.type || mine.span != theirs.span || mine.path != theirs.path ||
+			mine.comparison != theirs.comparison || mine.operand != theirs.operand)
+			return false;
+	}
+
+	return true;
+}
+
+
+
+
+bool EventFilter::matches (const Json::Value &payload) const {
+	if (program.empty ())
+		return true;
+
+	return evaluate (program.size () - 1, payload);
+}
+
+
+
+
+bool EventFilter::evaluate (size_t index, const Json::Value &payload) const {
+	const Instruction &instruction	= program[index];
+
+	switch (instruction.type) {
+	case InstructionType::Not :
+		return !evaluate (index - 1, payload);
+
+	case InstructionType::And :
+	case InstructionType::Or : {
+		// Right operand ends just before this instruction, left operand ends just before the right one
+		size_t right	= index - 1;
+		size_t left		= right - program[right].span;
+		bool result		= evaluate (left, payload);
+
+		if (result == (instruction.type == InstructionType::Or))
+			return result;
+		return evaluate (right, payload);
+	}
+
+	case InstructionType::Compare : {
+		const Json::Value *field	= resolve (payload, instruction.path);
+		if (!field)
+			return instruction.comparison == FilterOperator::Missing;
+
+		return compare (*field, instruction.comparison, instruction.operand);
+	}
+	}
+
+	return false;
+}
+
+
+
+
+std::vector<std::string> EventFilter::splitPath (const std::string &path) {
+	std::vector<std::string> segments;
+
+	size_t begin	= 0;
+	while (true) {
+		size_t end	= path.find ('.', begin);
+		segments.push_back (path.substr (begin, end - begin));
+		if (end == std::string::npos)
+			break;
+		begin	= end + 1;
+	}
+
+	return segments;
+}
+
+
+
+
+const Json::Value *EventFilter::resolve (const Json::Value &payload, const std::vector<std::string> &path) {
+	const Json::Value *field	= &payload;
+	for (auto &segment : path) {
+		if (field->isObject ()) {
+			field	= field->find (segment.data (), segment.data () + segment.size ());
+		}
+		else if (field->isArray () && !segment.empty () && segment.find_first_not_of ("0123456789") == std::string::npos) {
+			Json::ArrayIndex i	= std::strtoul (segment.c_str (), nullptr, 10);
+			field	= (i < field->size ()) ? &(*field)[i] : nullptr;
+		}
+		else {
+			field	= nullptr;
+		}
+
+		if (!field)
+			return nullptr;
+	}
+
+	return field;
+}
+
+
+
+
+bool EventFilter::compare (const Json::Value &field, FilterOperator comparison, const Json::Value &operand) {
+	if (comparison == FilterOperator::Exists)
+		return true;
+	if (comparison == FilterOperator::Missing)
+		return false;
+
+	// Numbers are compared by value, whatever their json representation is
+	int order;
+	if (field.isNumeric () && operand.isNumeric () && !field.isBool () && !operand.isBool ()) {
+		if (field.isInt64 () && operand.isInt64 ())
+			order	= (field.asInt64 () < operand.asInt64 ()) ? -1 : (field.asInt64 () > operand.asInt64 ());
+		else
+			order	= (field.asDouble () < operand.asDouble ()) ? -1 : (field.asDouble () > operand.asDouble ());
+	}
+	else if (field.isString () && operand.isString ()) {
+		// Strings are compared in place, without copying them out of the payload
+		const char *fieldBegin		= nullptr;
+		const char *fieldEnd		= nullptr;
+		const char *operandBegin	= nullptr;
+		const char *operandEnd		= nullptr;
+		field.getString (&fieldBegin, &fieldEnd);
+		operand.getString (&operandBegin, &operandEnd);
+
+		size_t fieldLength		= fieldEnd - fieldBegin;
+		size_t operandLength	= operandEnd - operandBegin;
+		size_t common			= std::min (fieldLength, operandLength);
+
+		order	= (common > 0) ? std::memcmp (fieldBegin, operandBegin, common) : 0;
+		if (order == 0)
+			order	= (fieldLength < operandLength) ? -1 : (fieldLength > operandLength);
+	}
+	else if (field.type () == operand.type ()) {
+		order	= field.compare (operand);
+	}
+	else {
+		// Values of different types are only different
+		return comparison == FilterOperator::NotEqual;
+	}
+
+	switch (comparison) {
+	case FilterOperator::Equal :		return order == 0;
+	case FilterOperator::NotEqual :		return order != 0;
+	case FilterOperator::Less :			return order < 0;
+	case FilterOperator::LessEqual :	return order <= 0;
+	case FilterOperator::Greater :		return order > 0;
+	case FilterOperator::GreaterEqual :	return order >= 0;
+	default :							return false;
+	}
+}
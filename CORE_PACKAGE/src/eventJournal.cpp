@@ -0,0 +1,411 @@
+/**
+ * \file eventJournal.cpp
+ * \author Luca Di Mauro
+ * \brief Implementation of class EventJournal
+ */
+
+
+#include <core/eventJournal.hpp>
+#include <core/exceptions.hpp>
+
+#include <algorithm>
+#include <vector>
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+using namespace microservicespp;
+using namespace microservicespp::utils;
+
+
+namespace {
+
+	/**
+	 * \brief Header written before service, event name and payload of each record
+	 */
+	struct RecordHeader {
+		uint32_t serviceLength;
+		uint32_t nameLength;
+		uint32_t payloadLength;
+		uint32_t checksum;
+	};
+
+
+	const size_t segmentNameLength	= 20;
+	const char *segmentSuffix		= ".log";
+
+
+	// FNV-1a. Its non zero basis makes an all zero header invalid, which marks the end of a segment
+	uint32_t checksum (const RecordHeader &header, const char *data) {
+		uint32_t hash	= 2166136261u;
+
+		auto mix	= [&hash] (const char *bytes, size_t length) {
+			for (size_t i=0; i<length; i++) {
+				hash	^= static_cast<unsigned char> (bytes[i]);
+				hash	*= 16777619u;
+			}
+		};
+
+		mix (reinterpret_cast<const char *> (&header), offsetof (RecordHeader, checksum));
+		mix (data, static_cast<size_t> (header.serviceLength) + header.nameLength + header.payloadLength);
+
+		return hash;
+	}
+
+
+	/**
+	 * \brief Reads the record at "position" of "data". Returns its total size, or 0 if there is no valid record
+	 */
+	size_t readRecord (const char *data, size_t size, size_t position, RecordHeader &header) {
+		if (size - position < sizeof (RecordHeader))
+			return 0;
+
+		memcpy (&header, data + position, sizeof (RecordHeader));
+		size_t length	= static_cast<size_t> (header.serviceLength) + header.nameLength + header.payloadLength;
+
+		if (length > size - position - sizeof (RecordHeader))
+			return 0;
+		if (checksum (header, data + position + sizeof (RecordHeader)) != header.checksum)
+			return 0;
+
+		return sizeof (RecordHeader) + length;
+	}
+
+
+	std::string segmentPath (const std::string &directory, uint64_t firstOffset) {
+		char name[segmentNameLength + 1];
+		snprintf (name, sizeof (name), "%020llu", static_cast<unsigned long long> (firstOffset));
+
+		return directory + "/" + name + segmentSuffix;
+	}
+
+
+	char *mapFile (int fd, size_t size, const std::string &path) {
+		void *data	= mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close (fd);
+
+		if (data == MAP_FAILED)
+			throw exceptions::EventManagerException ("Cannot map journal segment \"" + path + "\": " + strerror (errno));
+
+		return static_cast<char *> (data);
+	}
+
+
+	/**
+	 * \brief Makes durable the entries of "directory", so files just created in it survive a crash
+	 */
+	void syncDirectory (const std::string &directory) {
+		int fd	= open (directory.c_str (), O_RDONLY | O_DIRECTORY);
+		if (fd < 0)
+			throw exceptions::EventManagerException ("Cannot open journal directory \"" + directory + "\": " + strerror (errno));
+
+		int result	= fsync (fd);
+		int error	= errno;
+		close (fd);
+
+		if (result != 0)
+			throw exceptions::EventManagerException ("Cannot sync journal directory \"" + directory + "\": " + strerror (error));
+	}
+}
+
+
+
+
+EventJournal::EventJournal (std::string directory, JournalOptions options) : directory (directory), options (options),
+																			 durableOffset (0), stopFlusher (false) {
+	if (options.segmentSize <= sizeof (RecordHeader))
+		throw exceptions::EventManagerException ("Journal segment size too small");
+
+	if (mkdir (directory.c_str (), 0755) != 0 && errno != EEXIST)
+		throw exceptions::EventManagerException ("Cannot create journal directory \"" + directory + "\": " + strerror (errno));
+
+	DIR *dir	= opendir (directory.c_str ());
+	if (!dir)
+		throw exceptions::EventManagerException ("Cannot open journal directory \"" + directory + "\": " + strerror (errno));
+
+	std::vector<std::string> names;
+	while (struct dirent *entry = readdir (dir)) {
+		std::string name	= entry->d_name;
+		if (name.size () == segmentNameLength + strlen (segmentSuffix) &&
+			name.compare (segmentNameLength, std::string::npos, segmentSuffix) == 0 &&
+			std::all_of (name.begin (), name.begin () + segmentNameLength, [] (char c) { return isdigit (static_cast<unsigned char> (c)); }))
+			names.push_back (name);
+	}
+	closedir (dir);
+
+	// Names have fixed length, so their order is the order of offsets
+	std::sort (names.begin (), names.end ());
+
+	try {
+		for (auto &name : names)
+			openSegment (directory + "/" + name, std::stoull (name.substr (0, segmentNameLength)));
+
+		if (segments.empty ())
+			addSegment (0);
+	} catch (...) {
+		for (auto &segment : segments)
+			munmap (segment.data, segment.size);
+		throw;
+	}
+
+	durableOffset	= segments.back ().nextOffset;
+	flusher			= std::thread (&EventJournal::flusherLoop, this);
+}
+
+
+
+
+EventJournal::~EventJournal () {
+	{
+		std::unique_lock<std::mutex> lock (mutex);
+		stopFlusher	= true;
+	}
+	flushCondition.notify_all ();
+	flusher.join ();
+
+	for (auto &segment : segments)
+		munmap (segment.data, segment.size);
+}
+
+
+
+
+void EventJournal::addSegment (uint64_t firstOffset) {
+	std::string path	= segmentPath (directory, firstOffset);
+
+	int fd	= open (path.c_str (), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw exceptions::EventManagerException ("Cannot create journal segment \"" + path + "\": " + strerror (errno));
+
+	// The file is zero filled, so an empty header marks the end of written records. Blocks are reserved now, since a
+	// sparse file would fail on a full disk only when written through the mapping, raising SIGBUS
+	int error	= posix_fallocate (fd, 0, options.segmentSize);
+	if (error != 0) {
+		close (fd);
+		unlink (path.c_str ());
+		throw exceptions::EventManagerException ("Cannot allocate journal segment \"" + path + "\": " + strerror (error));
+	}
+
+	// Flushing the mapping later syncs the records, not the size of the file nor its entry in the directory: without
+	// them a crash could lose the whole segment, with records already reported as durable
+	if (fsync (fd) != 0) {
+		error	= errno;
+		close (fd);
+		unlink (path.c_str ());
+		throw exceptions::EventManagerException ("Cannot sync journal segment \"" + path + "\": " + strerror (error));
+	}
+
+	char *data	= mapFile (fd, options.segmentSize, path);
+	try {
+		syncDirectory (directory);
+	} catch (...) {
+		munmap (data, options.segmentSize);
+		unlink (path.c_str ());
+		throw;
+	}
+
+	segments.push_back (Segment {firstOffset, firstOffset, data, options.segmentSize, 0, 0});
+}
+
+
+
+
+void EventJournal::openSegment (const std::string &path, uint64_t firstOffset) {
+	int fd	= open (path.c_str (), O_RDWR);
+	if (fd < 0)
+		throw exceptions::EventManagerException ("Cannot open journal segment \"" + path + "\": " + strerror (errno));
+
+	struct stat info;
+	if (fstat (fd, &info) != 0 || info.st_size <= static_cast<off_t> (sizeof (RecordHeader))) {
+		close (fd);
+		return;
+	}
+
+	// A segment left sparse could still receive appends, so its blocks are reserved as for a new one
+	int error	= posix_fallocate (fd, 0, info.st_size);
+	if (error != 0) {
+		close (fd);
+		throw exceptions::EventManagerException ("Cannot allocate journal segment \"" + path + "\": " + strerror (error));
+	}
+
+	Segment segment {firstOffset, firstOffset, mapFile (fd, info.st_size, path), static_cast<size_t> (info.st_size), 0, 0};
+
+	RecordHeader header;
+	while (size_t recordSize = readRecord (segment.data, segment.size, segment.used, header)) {
+		segment.used	+= recordSize;
+		segment.nextOffset++;
+	}
+
+	// Clears what a crash left after the last valid record, so it can never be taken for a record after new appends
+	char *tail		= segment.data + segment.used;
+	size_t tailSize	= segment.size - segment.used;
+	if (std::any_of (tail, tail + std::min (tailSize, sizeof (RecordHeader)), [] (char c) { return c != 0; })) {
+		memset (tail, 0, tailSize);
+		msync (segment.data, segment.size, MS_SYNC);
+	}
+
+	segment.synced	= segment.used;
+	segments.push_back (segment);
+}
+
+
+
+
+void EventJournal::flusherLoop () {
+	std::unique_lock<std::mutex> lock (mutex);
+
+	while (true) {
+		flushCondition.wait_for (lock, std::chrono::milliseconds (options.flushInterval));
+
+		struct DirtyRange {
+			Segment *segment;
+			size_t begin;
+			size_t end;
+		};
+
+		// Records appended from now on are left to the next round
+		std::vector<DirtyRange> dirty;
+		for (auto &segment : segments) {
+			if (segment.used > segment.synced)
+				dirty.push_back (DirtyRange {&segment, segment.synced, segment.used});
+		}
+		uint64_t target	= segments.back ().nextOffset;
+
+		if (!dirty.empty ()) {
+			lock.unlock ();
+
+			// Mappings start on a page boundary, so the range is aligned down to it
+			static const size_t pageSize	= sysconf (_SC_PAGESIZE);
+			for (auto &range : dirty) {
+				size_t begin	= range.begin - range.begin % pageSize;
+				msync (range.segment->data + begin, range.end - begin, MS_SYNC);
+			}
+
+			lock.lock ();
+			for (auto &range : dirty)
+				range.segment->synced	= range.end;
+		}
+
+		if (target > durableOffset) {
+			durableOffset	= target;
+			durableCondition.notify_all ();
+		}
+
+		if (stopFlusher)
+			return;
+	}
+}
+
+
+
+
+uint64_t EventJournal::append (const std::string &service, const std::string &eventName, const std::string &payload) {
+	RecordHeader header;
+	header.serviceLength	= service.size ();
+	header.nameLength		= eventName.size ();
+	header.payloadLength	= payload.size ();
+
+	size_t recordSize	= sizeof (RecordHeader) + service.size () + eventName.size () + payload.size ();
+	if (recordSize > options.segmentSize)
+		throw exceptions::EventManagerException ("Record of event \"" + service + "/" + eventName + "\" is larger than a journal segment");
+
+	std::unique_lock<std::mutex> lock (mutex);
+
+	if (segments.back ().size - segments.back ().used < recordSize)
+		addSegment (segments.back ().nextOffset);
+
+	Segment &segment	= segments.back ();
+	char *record		= segment.data + segment.used;
+	char *body			= record + sizeof (RecordHeader);
+
+	memcpy (body, service.data (), service.size ());
+	memcpy (body + service.size (), eventName.data (), eventName.size ());
+	memcpy (body + service.size () + eventName.size (), payload.data (), payload.size ());
+	header.checksum	= checksum (header, body);
+	memcpy (record, &header, sizeof (RecordHeader));
+
+	segment.used	+= recordSize;
+
+	return segment.nextOffset++;
+}
+
+
+
+
+void EventJournal::sync (uint64_t offset) {
+	std::unique_lock<std::mutex> lock (mutex);
+
+	if (durableOffset > offset)
+		return;
+
+	// Publishers waiting together are served by the same flush
+	flushCondition.notify_one ();
+	durableCondition.wait (lock, [&] { return durableOffset > offset || stopFlusher; });
+}
+
+
+
+
+uint64_t EventJournal::replay (uint64_t fromOffset, RecordHandler handler) {
+	std::vector<Segment> snapshot;
+	{
+		std::unique_lock<std::mutex> lock (mutex);
+		for (auto &segment : segments) {
+			if (segment.nextOffset > fromOffset)
+				snapshot.push_back (segment);
+		}
+	}
+
+	uint64_t next	= fromOffset;
+
+	// Records already appended are never modified, so they are read without holding "mutex"
+	for (auto &segment : snapshot) {
+		uint64_t offset	= segment.firstOffset;
+		size_t position	= 0;
+		RecordHeader header;
+
+		while (offset < segment.nextOffset) {
+			size_t recordSize	= readRecord (segment.data, segment.used, position, header);
+			if (recordSize == 0)
+				break;
+
+			if (offset >= fromOffset) {
+				const char *body	= segment.data + position + sizeof (RecordHeader);
+				handler (offset,
+						 std::string (body, header.serviceLength),
+						 std::string (body + header.serviceLength, header.nameLength),
+						 std::string (body + header.serviceLength + header.nameLength, header.payloadLength));
+				next	= offset + 1;
+			}
+
+			position	+= recordSize;
+			offset++;
+		}
+	}
+
+	return next;
+}
+
+
+
+
+uint64_t EventJournal::nextOffset () {
+	std::unique_lock<std::mutex> lock (mutex);
+
+	return segments.back ().nextOffset;
+}
+
+
+
+
+const JournalOptions &EventJournal::getOptions () const {
+	return options;
+}
@@ -0,0 +1,2463 @@
+/**
+ * \file eventManager.cpp
+ * \author Luca Di Mauro
+ * \brief Implementation of class EventManager
+ */
+
+
+#include <core/microservicespp.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+using namespace microservicespp;
+
+
+// Maximum number of payloads handed to a subscriber by a dispatcher before serving other subscribers
+static const size_t maxDrainedPayloads	= 256;
+
+// Every "lowLaneShare" turns, general dispatchers look at the low priority lane before the normal one
+static const unsigned lowLaneShare	= 4;
+
+// Number of dead letters kept before discarding the oldest ones
+static const size_t deadLetterCapacity	= 1024;
+
+// True on dispatcher threads, where publishers must never wait for a mailbox to be drained
+static thread_local bool insideDispatcher	= false;
+
+// True while an inline handler runs, so the payloads it triggers are never handled inline in its stack
+static thread_local bool insideInlineHandler	= false;
+
+// Source of the generations of managers
+static std::atomic<uint64_t> nextGeneration (1);
+
+// True while the timer thread publishes, which must never wait: deadlines of other timers would be missed
+static thread_local bool insideTimer	= false;
+
+
+
+
+namespace {
+
+	/**
+	 * \brief Payload of a request, carrying the promise of its reply. The promise is resolved once, either by the
+	 * responder or by the deadline; if the request is dropped unanswered, its future reports a broken promise
+	 */
+	class RequestObject : public EventObject {
+	private :
+		SharedPayload payload;
+		mutable std::promise<Json::Value> reply;
+		mutable std::atomic<bool> answered;
+
+	public :
+		utils::TimerQueue::Clock::time_point deadline;
+		bool hasDeadline;
+
+		RequestObject (SharedPayload payload) : payload (payload), answered (false), hasDeadline (false) {}
+
+		const Json::Value &asJson () const override		{ return *payload; }
+		const std::type_info &type () const override	{ return typeid (Json::Value); }
+		const void *get () const override				{ return payload.get (); }
+
+		std::future<Json::Value> getReply () {
+			return reply.get_future ();
+		}
+
+		bool isExpired () const {
+			return hasDeadline && utils::TimerQueue::Clock::now () >= deadline;
+		}
+
+		void answer (Json::Value value) const {
+			if (!answered.exchange (true))
+				reply.set_value (std::move (value));
+		}
+
+		void fail (std::exception_ptr error) const {
+			if (!answered.exchange (true))
+				reply.set_exception (error);
+		}
+	};
+}
+
+
+
+
+EventManager::EventManager (Engine &engine) : engine (engine), eventTable (new EventTable {{}, std::make_shared<EventNames> (), nullptr}), nextSubscriptionId (0), latencyTracing (false),
+		generation (nextGeneration++), latencyRecords (std::make_shared<LatencyRecords> ()), stopDispatchers (false) {
+	unsigned dispatchersNumber	= std::max (2u, std::thread::hardware_concurrency ());
+
+	// The first dispatcher is reserved to high priority events
+	for (unsigned i=0; i<dispatchersNumber; i++)
+		dispatchers.emplace_back (&EventManager::dispatcherLoop, this, i == 0);
+}
+
+
+
+
+EventManager::~EventManager () {
+	{
+		std::unique_lock<std::mutex> lock (deliveriesMutex);
+		stopDispatchers	= true;
+	}
+	deliveriesCondition.notify_all ();
+	highLaneCondition.notify_all ();
+
+	for (auto &t : dispatchers)
+		t.join ();
+}
+
+
+
+
+EventId EventManager::internEvent (const std::string &service, const std::string &eventName) {
+	const EventTable *table	= eventTable.get ();
+	auto serviceIt			= table->names->find (service);
+
+	if (serviceIt != table->names->end ()) {
+		auto idIt	= serviceIt->second.find (eventName);
+		if (idIt != serviceIt->second.end ())
+			return idIt->second;
+	}
+
+	// Identifiers are never reused, so handles held by services stay valid across leave and join
+	EventId id				= table->events.size ();
+	EventEntry *entry		= new EventEntry ();
+	entry->service			= service;
+	entry->name				= eventName;
+	entry->registered		= false;
+	entry->runtime			= std::make_shared<EventRuntime> ();
+
+	auto limiterIt	= serviceRateLimiters.find (service);
+	if (limiterIt != serviceRateLimiters.end ())
+		entry->serviceRateLimiter	= limiterIt->second;
+
+	// Pattern subscriptions are resolved once here, so triggering the event never looks at patterns
+	patternSubscriptions.match (topicOf (*entry), entry->subscribers);
+	for (auto &subscription : entry->subscribers)
+		subscription->events.push_back (id);
+
+	std::unique_ptr<EventTable> newTable (new EventTable (*table));
+	std::shared_ptr<EventNames> newNames	= std::make_shared<EventNames> (*table->names);
+	(*newNames)[service][eventName]			= id;
+	newTable->names							= newNames;
+	newTable->events.push_back (std::shared_ptr<const EventEntry> (entry));
+
+	eventTable.publish (newTable.release ());
+
+	return id;
+}
+
+
+
+
+void EventManager::updateEntry (EventId id, std::function<void (EventEntry &)> change) {
+	const EventTable *table	= eventTable.get ();
+	std::unique_ptr<EventEntry> newEntry (new EventEntry (getEntry (*table, id)));
+
+	change (*newEntry);
+
+	std::unique_ptr<EventTable> newTable (new EventTable (*table));
+	newTable->events.set (id, std::shared_ptr<const EventEntry> (newEntry.release ()));
+
+	eventTable.publish (newTable.release ());
+}
+
+
+
+
+const EventManager::EventEntry &EventManager::getEntry (const EventTable &table, EventId id) {
+	if (id >= table.events.size ())
+		throw exceptions::EventManagerException ("Unknown event identifier " + std::to_string (id));
+
+	return *table.events[id];
+}
+
+
+
+
+bool EventManager::nextReadyMailbox (bool highLaneOnly, unsigned &turn, ReadyMailbox &ready) {
+	static const EventPriority normalFirst[]	= {EventPriority::High, EventPriority::Normal, EventPriority::Low};
+	static const EventPriority lowFirst[]		= {EventPriority::High, EventPriority::Low, EventPriority::Normal};
+
+	// Low priority lane is served from time to time even when normal priority lane is always full
+	const EventPriority *order	= (++turn % lowLaneShare == 0) ? lowFirst : normalFirst;
+	size_t lanes				= highLaneOnly ? 1 : 3;
+
+	for (size_t i=0; i<lanes; i++) {
+		auto &lane	= readyMailboxes[static_cast<size_t> (order[i])];
+		if (!lane.empty ()) {
+			ready	= std::move (lane.front ());
+			lane.pop_front ();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+
+
+void EventManager::dispatcherLoop (bool highLaneOnly) {
+	insideDispatcher	= true;
+	unsigned turn		= 0;
+
+	std::condition_variable &condition	= highLaneOnly ? highLaneCondition : deliveriesCondition;
+
+	while (true) {
+		ReadyMailbox ready;
+		{
+			std::unique_lock<std::mutex> lock (deliveriesMutex);
+			bool found	= false;
+			condition.wait (lock, [&] {
+				return (found = nextReadyMailbox (highLaneOnly, turn, ready)) || stopDispatchers;
+			});
+
+			// A non empty mailbox is always scheduled, so nothing is lost on exit
+			if (!found)
+				return;
+		}
+
+		std::shared_ptr<Subscription> &subscription	= ready.subscription;
+		Mailbox &mailbox							= *ready.mailbox;
+		{
+			std::unique_lock<std::mutex> lock (mailbox.mutex);
+
+			// The mailbox was scheduled again in a higher lane, and it is served through that entry
+			if (ready.ticket != mailbox.ticket)
+				continue;
+
+			// Payloads of a paused subscription are kept, and scheduled again when it is resumed
+			if (subscription->paused) {
+				mailbox.scheduled	= false;
+				continue;
+			}
+			mailbox.draining	= true;
+		}
+
+		bool batches	= subscription->replicaHandlers.empty () ? static_cast<bool> (subscription->batchHandler)
+																 : static_cast<bool> (subscription->replicaHandlers[mailbox.replica].second);
+		size_t budget	= maxDrainedPayloads;
+
+		while (true) {
+			std::vector<PendingEvent> objects;
+			{
+				std::unique_lock<std::mutex> lock (mailbox.mutex);
+				bool found;
+				EventPriority top	= mailbox.topPriority (found);
+
+				// Only one dispatcher at a time drains a mailbox, so payloads are handled in order. The high lane dispatcher
+				// leaves lower priority payloads to the others
+				if (!found || subscription->paused || budget == 0 || (highLaneOnly && top != EventPriority::High)) {
+					mailbox.draining	= false;
+					if (!found || subscription->paused)
+						mailbox.scheduled	= false;
+					else
+						schedule (subscription, mailbox, top);
+					break;
+				}
+
+				// Lower priority payloads are taken one at a time, so a high priority one waits for at most one handler
+				MailboxLane &lane	= mailbox.lane (top);
+				size_t count		= (top == EventPriority::High || batches) ? std::min (lane.pending.size (), budget) : 1;
+				budget				-= count;
+
+				objects.reserve (count);
+				for (size_t i=0; i<count; i++) {
+					objects.push_back (std::move (lane.pending.front ()));
+					lane.popFront ();
+				}
+			}
+			mailbox.notFull.notify_all ();
+
+			// Payloads of a cancelled subscription are drained anyway, so blocked publishers are released
+			if (!subscription->cancelled) {
+				size_t handled		= deliver (*subscription, mailbox.replica, objects.data (), objects.size ());
+				mailbox.delivered	+= handled;
+				mailbox.dropped		+= objects.size () - handled;
+			}
+			if (!subscription->replicaHandlers.empty ())
+				mailbox.load	-= objects.size ();
+		}
+	}
+}
+
+
+
+
+std::string EventManager::topicOf (const EventEntry &entry) {
+	return entry.service + "/" + entry.name;
+}
+
+
+
+
+std::string EventManager::routeOf (const Subscription &subscription, EventId event, bool responder) {
+	if (!subscription.pattern.empty ())
+		return "pattern " + subscription.pattern;
+
+	return (responder ? "endpoint " : "event ") + std::to_string (event);
+}
+
+
+
+
+SubscriptionId EventManager::subscribe (EventId event, std::shared_ptr<Subscription> subscription) {
+	prepareSubscription (*subscription);
+
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	subscription->id	= nextSubscriptionId++;
+
+	if (holdSubscription (subscription, event, false) || joinReplicas (subscription, event, false))
+		return subscription->id;
+
+	// The event could be registered later, when its service joins
+	updateEntry (event, [&] (EventEntry &entry) {
+		entry.subscribers.push_back (subscription);
+	});
+	subscription->events.push_back (event);
+
+	indexSubscription (subscription);
+	lock.unlock ();
+
+	if (subscription->options.lastValue)
+		deliverLastValue (subscription, event);
+
+	return subscription->id;
+}
+
+
+
+
+SubscriptionId EventManager::subscribePattern (std::string pattern, std::shared_ptr<Subscription> subscription) {
+	// Held and replicated subscriptions reach the trie later, when it is too late to refuse them
+	utils::TopicTrie<std::shared_ptr<Subscription>>::validate (pattern);
+	prepareSubscription (*subscription);
+
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	subscription->id		= nextSubscriptionId++;
+	subscription->pattern	= pattern;
+
+	if (holdSubscription (subscription, 0, false) || joinReplicas (subscription, 0, false))
+		return subscription->id;
+
+	std::unique_ptr<EventTable> newTable (new EventTable (*eventTable.get ()));
+	attachSubscription (*newTable, StandbySubscription {subscription, 0, false});
+	eventTable.publish (newTable.release ());
+
+	indexSubscription (subscription);
+
+	return subscription->id;
+}
+
+
+
+
+void EventManager::prepareSubscription (Subscription &subscription) {
+	if (subscription.options.queueCapacity == 0)
+		throw exceptions::EventManagerException ("Queue capacity of subscriptions must be greater than zero");
+
+	size_t partitions	= 1;
+	if (subscription.options.partitionKey)
+		partitions	= subscription.options.partitions != 0 ? subscription.options.partitions : dispatchers.size ();
+
+	for (size_t i=0; i<partitions; i++)
+		subscription.mailboxes.emplace_back (new Mailbox ());
+
+	const SubscriptionOptions &options	= subscription.options;
+	if (options.maxFailureRate < 0 || (options.maxFailureRate > 0 && options.failureBurst == 0))
+		throw exceptions::EventManagerException ("Failure limits of subscriptions need a non negative rate and a burst of at least one failure");
+
+	if (options.maxFailureRate > 0)
+		subscription.failureBudget.reset (new utils::TokenBucket (options.maxFailureRate, options.failureBurst));
+
+	// A cached payload goes through the mailbox, and could be handled after a newer payload handled inline
+	if (options.inlineDispatch && options.lastValue)
+		throw exceptions::EventManagerException ("Inline subscriptions cannot receive the last value of events");
+
+	subscription.inlined	= options.inlineDispatch;
+}
+
+
+
+
+void EventManager::indexSubscription (const std::shared_ptr<Subscription> &subscription) {
+	subscriptions[subscription->id]	= subscription;
+
+	if (!subscription->options.owner.empty ())
+		ownedSubscriptions[subscription->options.owner].insert (subscription->id);
+}
+
+
+
+
+bool EventManager::joinReplicas (std::shared_ptr<Subscription> &subscription, EventId event, bool responder) {
+	const std::string &owner	= subscription->options.owner;
+	if (owner.empty ())
+		return false;
+
+	auto replicatedIt	= replicatedServices.find (owner);
+	if (replicatedIt == replicatedServices.end ())
+		return false;
+
+	ReplicatedService &replicated	= replicatedIt->second;
+	const ReplicaOptions &replicas	= replicated.options;
+	std::string route				= routeOf (*subscription, event, responder);
+	if (replicated.joining == replicas.replicas)
+		throw exceptions::EventManagerException ("Subscriptions of replicated service \"" + owner + "\" must be made while its replicas start");
+
+	// Payloads are already partitioned among replicas, possibly by the affinity key
+	if (subscription->options.partitionKey)
+		throw exceptions::EventManagerException ("Subscription of replicated service \"" + owner + "\" to " + route + " cannot be partitioned");
+
+	unsigned &ordinal	= replicated.ordinals[std::make_pair (route, replicated.joining)];
+	auto groupKey		= std::make_pair (route, ordinal);
+
+	// The first replica makes the subscriptions shared by all of them, which wait for the others before delivering
+	if (replicated.joining == 0) {
+		subscription->mailboxes.clear ();
+		for (unsigned i=0; i<replicas.replicas; i++) {
+			subscription->mailboxes.emplace_back (new Mailbox ());
+			subscription->mailboxes.back ()->replica	= i;
+		}
+
+		subscription->replicaHandlers.resize (replicas.replicas);
+		subscription->replicaHandlers[0]	= std::make_pair (subscription->handler, subscription->batchHandler);
+		subscription->joinedReplicas		= 1;
+		subscription->options.partitionKey	= replicas.balance == BalancePolicy::KeyAffinity ? replicas.affinityKey : nullptr;
+		subscription->paused				= true;
+
+		// Publishers would run the handler of a single replica
+		subscription->inlined	= false;
+
+		replicated.groups[groupKey]	= subscription;
+		ordinal++;
+		return false;
+	}
+
+	auto groupIt	= replicated.groups.find (groupKey);
+	if (groupIt == replicated.groups.end ())
+		throw exceptions::EventManagerException ("Replica " + std::to_string (replicated.joining) + " of service \"" + owner +
+												 "\" subscribed to " + route + " more times than the first one");
+
+	// Replicas share mailboxes, queues and filter, so they must ask for the same ones
+	std::shared_ptr<Subscription> &group	= groupIt->second;
+	const SubscriptionOptions &mine			= subscription->options;
+	const SubscriptionOptions &shared		= group->options;
+	if (mine.queueCapacity != shared.queueCapacity || mine.backpressure != shared.backpressure || mine.filter != shared.filter ||
+		mine.lastValue != shared.lastValue || mine.maxFailureRate != shared.maxFailureRate || mine.failureBurst != shared.failureBurst ||
+		mine.inlineDispatch != shared.inlineDispatch || mine.inlineBudget != shared.inlineBudget ||
+		subscription->objectType != group->objectType || static_cast<bool> (subscription->batchHandler) != static_cast<bool> (group->batchHandler))
+		throw exceptions::EventManagerException ("Replica " + std::to_string (replicated.joining) + " of service \"" + owner +
+												 "\" subscribed to " + route + " with options different from the first one");
+
+	group->replicaHandlers[replicated.joining]	= std::make_pair (subscription->handler, subscription->batchHandler);
+	group->joinedReplicas++;
+	ordinal++;
+
+	subscription	= group;
+	return true;
+}
+
+
+
+
+bool EventManager::holdSubscription (const std::shared_ptr<Subscription> &subscription, EventId event, bool responder) {
+	const std::string &owner	= subscription->options.owner;
+	if (owner.empty ())
+		return false;
+
+	auto reloadIt	= reloadingServices.find (owner);
+	if (reloadIt == reloadingServices.end ())
+		return false;
+
+	// Errors are reported now, since attaching the subscription when the reload ends cannot fail
+	if (subscription->pattern.empty ()) {
+		const EventEntry &entry	= getEntry (*eventTable.get (), event);
+
+		if (responder) {
+			bool taken	= entry.responder && entry.responder->options.owner != owner;
+			for (auto &standby : reloadIt->second)
+				taken	= taken || (standby.responder && standby.event == event);
+
+			if (taken)
+				throw exceptions::EventManagerException ("Endpoint \"" + topicOf (entry) + "\" already has a responder");
+		}
+	}
+
+	subscription->paused	= true;
+	indexSubscription (subscription);
+	reloadIt->second.push_back (StandbySubscription {subscription, event, responder});
+
+	return true;
+}
+
+
+
+
+void EventManager::attachSubscription (EventTable &newTable, const StandbySubscription &standby) {
+	const std::shared_ptr<Subscription> &subscription	= standby.subscription;
+
+	if (subscription->pattern.empty ()) {
+		EventEntry *newEntry	= new EventEntry (*newTable.events[standby.event]);
+		if (standby.responder)
+			newEntry->responder	= subscription;
+		else
+			newEntry->subscribers.push_back (subscription);
+		newTable.events.set (standby.event, std::shared_ptr<const EventEntry> (newEntry));
+		subscription->events.push_back (standby.event);
+
+		return;
+	}
+
+	// Future events are resolved through the trie, existing ones are resolved now
+	patternSubscriptions.insert (subscription->pattern, subscription);
+
+	for (EventId id=0; id<newTable.events.size (); id++) {
+		const EventEntry &entry	= *newTable.events[id];
+		if (utils::TopicTrie<std::shared_ptr<Subscription>>::matches (subscription->pattern, topicOf (entry))) {
+			EventEntry *newEntry	= new EventEntry (entry);
+			newEntry->subscribers.push_back (subscription);
+			newTable.events.set (id, std::shared_ptr<const EventEntry> (newEntry));
+			subscription->events.push_back (id);
+		}
+	}
+}
+
+
+
+
+void EventManager::movePending (Subscription &from, Subscription &to) {
+	for (auto &source : from.mailboxes) {
+		std::deque<PendingEvent> moved[3];
+		{
+			std::unique_lock<std::mutex> lock (source->mutex);
+			for (size_t i=0; i<3; i++) {
+				MailboxLane &lane	= source->lanes[i];
+				moved[i].swap (lane.pending);
+				lane.headSequence	+= moved[i].size ();
+				lane.conflatedSlots.clear ();
+			}
+		}
+		source->notFull.notify_all ();
+
+		// Payloads keep their lane and their order within each target mailbox, and come before those published after the swap
+		std::map<std::pair<Mailbox *, size_t>, std::vector<PendingEvent>> targets;
+		for (size_t i=0; i<3; i++) {
+			for (auto &pending : moved[i]) {
+				if (std::find (to.events.begin (), to.events.end (), pending.event) == to.events.end ()) {
+					source->dropped++;
+					continue;
+				}
+
+				targets[std::make_pair (&mailboxOf (to, pending.object), i)].push_back (std::move (pending));
+			}
+		}
+
+		for (auto &target : targets) {
+			Mailbox &mailbox	= *target.first.first;
+			MailboxLane &lane	= mailbox.lanes[target.first.second];
+			std::unique_lock<std::mutex> lock (mailbox.mutex);
+
+			for (auto it=target.second.rbegin (); it!=target.second.rend (); ++it)
+				lane.pending.push_front (std::move (*it));
+			lane.headSequence	-= target.second.size ();
+		}
+	}
+}
+
+
+
+
+void EventManager::resumeDelivery (const std::shared_ptr<Subscription> &subscription) {
+	// A placeholder which got payloads, also moved from a stopped lazy service, asks again for its service
+	if (subscription->activation && !subscription->cancelled) {
+		bool pending	= false;
+		for (auto &mailbox : subscription->mailboxes) {
+			std::unique_lock<std::mutex> lock (mailbox->mutex);
+			pending	= pending || mailbox->size () > 0;
+		}
+
+		if (pending && !subscription->activating.exchange (true))
+			timers.schedule (utils::TimerQueue::Clock::now (), subscription->activation);
+		return;
+	}
+
+	subscription->paused	= false;
+
+	for (auto &mailbox : subscription->mailboxes) {
+		std::unique_lock<std::mutex> lock (mailbox->mutex);
+		bool found;
+		EventPriority top	= mailbox->topPriority (found);
+		if (found && !mailbox->scheduled)
+			schedule (subscription, *mailbox, top);
+	}
+}
+
+
+
+
+void EventManager::cancelSubscription (EventTable &newTable, std::shared_ptr<Subscription> subscription) {
+	detachSubscription (newTable, subscription);
+	forgetSubscription (subscription);
+}
+
+
+
+
+void EventManager::detachSubscription (EventTable &newTable, const std::shared_ptr<Subscription> &subscription) {
+	for (EventId event : subscription->events) {
+		EventEntry *newEntry	= new EventEntry (*newTable.events[event]);
+		auto &subscribers		= newEntry->subscribers;
+		subscribers.erase (std::remove (subscribers.begin (), subscribers.end (), subscription), subscribers.end ());
+		if (newEntry->responder == subscription)
+			newEntry->responder.reset ();
+		newTable.events.set (event, std::shared_ptr<const EventEntry> (newEntry));
+	}
+}
+
+
+
+
+void EventManager::forgetSubscription (const std::shared_ptr<Subscription> &subscription) {
+	subscription->cancelled	= true;
+	subscription->events.clear ();
+
+	if (!subscription->pattern.empty ())
+		patternSubscriptions.remove (subscription->pattern, subscription);
+
+	if (!subscription->options.owner.empty ()) {
+		auto ownedIt	= ownedSubscriptions.find (subscription->options.owner);
+		ownedIt->second.erase (subscription->id);
+		if (ownedIt->second.empty ())
+			ownedSubscriptions.erase (ownedIt);
+	}
+
+	subscriptions.erase (subscription->id);
+}
+
+
+
+
+EventManager::Mailbox &EventManager::mailboxOf (const Subscription &subscription, const SharedEventObject &object) {
+	if (subscription.mailboxes.size () == 1)
+		return *subscription.mailboxes.front ();
+
+	// Replicated subscriptions are delivered only when all replicas joined, so the same key always finds the same replica
+	size_t mailboxes	= subscription.mailboxes.size ();
+
+	if (subscription.options.partitionKey) {
+		size_t partition	= std::hash<std::string> () (subscription.options.partitionKey (object->asJson ()));
+		return *subscription.mailboxes[partition % mailboxes];
+	}
+
+	// The search starts from a different replica each time, so that replicas with the same load take turns
+	size_t first	= subscription.nextReplica++ % mailboxes;
+	size_t chosen	= first;
+	for (size_t i=1; i<mailboxes; i++) {
+		size_t candidate	= (first + i) % mailboxes;
+		if (subscription.mailboxes[candidate]->load < subscription.mailboxes[chosen]->load)
+			chosen	= candidate;
+	}
+
+	return *subscription.mailboxes[chosen];
+}
+
+
+
+
+void EventManager::enqueue (const std::shared_ptr<Subscription> &subscription, EventId event, const EventOptions &eventOptions,
+							const SharedEventObject *objects, const uint64_t *sequences, size_t count,
+							std::vector<DeferredPayloads> *deferred) {
+	const SubscriptionOptions &options	= subscription->options;
+
+	if (subscription->suspended) {
+		subscription->mailboxes.front ()->dropped	+= count;
+		return;
+	}
+
+	// Sequences matter only to subscriptions which received a cached payload, and pattern ones never do
+	if (!options.lastValue || !subscription->pattern.empty ())
+		sequences	= nullptr;
+
+	// Filters are evaluated before taking the lock, on the json form of payloads. Counters are summed over partitions
+	std::vector<SharedEventObject> accepted;
+	std::vector<uint64_t> acceptedSequences;
+	if (!options.filter.isEmpty ()) {
+		for (size_t i=0; i<count; i++) {
+			if (options.filter.matches (objects[i]->asJson ())) {
+				accepted.push_back (objects[i]);
+				if (sequences)
+					acceptedSequences.push_back (sequences[i]);
+			}
+			else {
+				subscription->mailboxes.front ()->filtered++;
+			}
+		}
+
+		objects		= accepted.data ();
+		sequences	= sequences ? acceptedSequences.data () : nullptr;
+		count		= accepted.size ();
+		if (count == 0)
+			return;
+	}
+
+	enqueueAccepted (subscription, event, eventOptions, objects, sequences, count, deferred);
+}
+
+
+
+
+void EventManager::enqueueAccepted (const std::shared_ptr<Subscription> &subscription, EventId event, const EventOptions &eventOptions,
+									const SharedEventObject *objects, const uint64_t *sequences, size_t count,
+									std::vector<DeferredPayloads> *deferred) {
+	auto defer	= [&] (size_t first) {
+		deferred->push_back (DeferredPayloads {subscription, event, eventOptions,
+											   std::vector<SharedEventObject> (objects + first, objects + count),
+											   sequences ? std::vector<uint64_t> (sequences + first, sequences + count) : std::vector<uint64_t> ()});
+	};
+
+	// Once some payloads of a publisher wait for room, the following ones for the same subscription wait behind them
+	if (deferred && std::any_of (deferred->begin (), deferred->end (), [&] (const DeferredPayloads &d) { return d.subscription == subscription; })) {
+		defer (0);
+		return;
+	}
+
+	// Inline handlers run only after the publisher releases the table, so they may subscribe or register events
+	if (subscription->inlined && !insideInlineHandler && !subscription->paused) {
+		if (deferred) {
+			defer (0);
+			return;
+		}
+
+		// Counted before looking at the pause again, so "pauseSubscriptions" either waits for this delivery or is seen here
+		subscription->inlineDeliveries++;
+		bool delivered	= !subscription->paused;
+		if (delivered && !subscription->cancelled)
+			deliverInline (*subscription, event, eventOptions, objects, count);
+		subscription->inlineDeliveries--;
+
+		// Payloads of a subscription paused in the meantime wait in its mailbox
+		if (delivered)
+			return;
+	}
+
+	// The lock is kept while consecutive payloads go to the same partition
+	Mailbox *mailbox	= nullptr;
+	std::unique_lock<std::mutex> lock;
+
+	for (size_t i=0; i<count; i++) {
+		Mailbox &target	= mailboxOf (*subscription, objects[i]);
+		if (&target != mailbox) {
+			if (lock)
+				lock.unlock ();
+			mailbox	= &target;
+			lock	= std::unique_lock<std::mutex> (mailbox->mutex);
+		}
+
+		// A publisher which saw the new subscriber could come after the cached payload was delivered, with an older one
+		uint64_t lastSequence	= mailbox->lastSequence;
+		if (sequences) {
+			if (sequences[i] <= mailbox->lastSequence)
+				continue;
+			mailbox->lastSequence	= sequences[i];
+		}
+
+		if (!push (subscription, *mailbox, lock, event, eventOptions, objects[i], deferred == nullptr)) {
+			mailbox->lastSequence	= lastSequence;
+			defer (i);
+			return;
+		}
+	}
+}
+
+
+
+
+void EventManager::enqueueDeferred (std::vector<DeferredPayloads> &deferred) {
+	for (auto &payloads : deferred)
+		enqueueAccepted (payloads.subscription, payloads.event, payloads.eventOptions, payloads.objects.data (),
+						 payloads.sequences.empty () ? nullptr : payloads.sequences.data (), payloads.objects.size (), nullptr);
+}
+
+
+
+
+bool EventManager::push (const std::shared_ptr<Subscription> &subscription, Mailbox &mailbox, std::unique_lock<std::mutex> &lock,
+						 EventId event, const EventOptions &eventOptions, const SharedEventObject &object, bool mayWait) {
+	const SubscriptionOptions &options	= subscription->options;
+	bool conflated						= eventOptions.conflated;
+	MailboxLane &lane					= mailbox.lane (eventOptions.priority);
+
+	// A conflated payload replaces in place the one not yet handled, without taking a new slot
+	if (conflated) {
+		auto slot	= lane.conflatedSlots.find (event);
+		if (slot != lane.conflatedSlots.end ()) {
+			PendingEvent &pending	= lane.pending[slot->second - lane.headSequence];
+			pending.object			= object;
+			pending.enqueued		= latencyTracing ? utils::steadyNanoseconds () : 0;
+			mailbox.conflated++;
+			return true;
+		}
+	}
+
+	// The timer thread makes room as DropOldest would, instead of waiting for it
+	BackpressurePolicy policy	= options.backpressure;
+	if (policy == BackpressurePolicy::Block && insideTimer)
+		policy	= BackpressurePolicy::DropOldest;
+
+	if (mailbox.size () >= options.queueCapacity) {
+		switch (policy) {
+		case BackpressurePolicy::Block :
+			// Waiting on a dispatcher thread could leave no one to drain the mailbox
+			if (insideDispatcher) {
+				mailbox.dropped++;
+				return true;
+			}
+			if (!mayWait)
+				return false;
+			mailbox.notFull.wait (lock, [&] { return mailbox.size () < options.queueCapacity; });
+			break;
+
+		case BackpressurePolicy::DropNewest :
+			mailbox.dropped++;
+			return true;
+
+		case BackpressurePolicy::DropOldest :
+		case BackpressurePolicy::Coalesce : {
+			// Room is made only at the expense of payloads not more important than this one, otherwise this one is dropped
+			MailboxLane *victim	= nullptr;
+			for (size_t i=3; i-- > static_cast<size_t> (eventOptions.priority) && !victim; ) {
+				if (!mailbox.lanes[i].pending.empty ())
+					victim	= &mailbox.lanes[i];
+			}
+			if (!victim) {
+				mailbox.dropped++;
+				return true;
+			}
+
+			// DropOldest discards the earliest payload of the lane, Coalesce replaces the latest one
+			if (policy == BackpressurePolicy::DropOldest) {
+				victim->popFront ();
+				mailbox.dropped++;
+			}
+			else {
+				victim->popBack ();
+				mailbox.coalesced++;
+			}
+			if (!subscription->replicaHandlers.empty ())
+				mailbox.load--;
+			break;
+		}
+		}
+	}
+
+	if (conflated)
+		lane.conflatedSlots[event]	= lane.headSequence + lane.pending.size ();
+	lane.pending.push_back (PendingEvent {event, object, latencyTracing ? utils::steadyNanoseconds () : 0});
+	if (!subscription->replicaHandlers.empty ())
+		mailbox.load++;
+
+	// Scheduling now (and not after all payloads) guarantees that a blocked publisher will be woken up. A mailbox waiting
+	// in a lower lane moves to the lane of this payload, unless a dispatcher already drains it from the highest lane
+	if (!subscription->paused && (!mailbox.scheduled || (!mailbox.draining && eventOptions.priority < mailbox.scheduledLane))) {
+		schedule (subscription, mailbox, eventOptions.priority);
+	}
+	else if (subscription->activation && !subscription->cancelled && !subscription->activating.exchange (true)) {
+		timers.schedule (utils::TimerQueue::Clock::now (), subscription->activation);
+	}
+
+	return true;
+}
+
+
+
+
+void EventManager::deliverLastValue (const std::shared_ptr<Subscription> &subscription, EventId event) {
+	std::shared_ptr<const EventEntry> entry;
+	{
+		auto table	= eventTable.read ();
+		entry		= table->events[event];
+	}
+
+	if (!entry->options.sticky)
+		return;
+
+	// The cached payload must be read under the lock of its partition, which depends on the payload itself
+	SharedEventObject lastValue;
+	uint64_t sequence;
+	Mailbox *mailbox;
+	std::unique_lock<std::mutex> lock;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> runtimeLock (entry->runtime->mutex);
+			lastValue	= entry->runtime->lastValue;
+		}
+		if (!lastValue)
+			return;
+
+		// An object without json form was triggered only because earlier subscribers did not need it
+		if (!lastValue->hasJson () && needsJson (*subscription, *lastValue))
+			return;
+
+		mailbox	= &mailboxOf (*subscription, lastValue);
+		lock	= std::unique_lock<std::mutex> (mailbox->mutex);
+
+		// Payloads already enqueued by publishers which saw the subscriber are not newer than the cached one
+		std::unique_lock<std::mutex> runtimeLock (entry->runtime->mutex);
+		if (entry->runtime->lastValue == lastValue) {
+			sequence	= entry->runtime->sequence;
+			break;
+		}
+
+		lock.unlock ();
+	}
+
+	if (sequence <= mailbox->lastSequence)
+		return;
+	mailbox->lastSequence	= sequence;
+
+	if (subscription->options.filter.isEmpty () || subscription->options.filter.matches (lastValue->asJson ()))
+		push (subscription, *mailbox, lock, event, entry->options, lastValue, true);
+	else
+		mailbox->filtered++;
+}
+
+
+
+
+void EventManager::schedule (const std::shared_ptr<Subscription> &subscription, Mailbox &mailbox, EventPriority priority) {
+	mailbox.scheduled		= true;
+	mailbox.scheduledLane	= priority;
+	mailbox.ticket++;
+	{
+		std::unique_lock<std::mutex> lock (deliveriesMutex);
+		readyMailboxes[static_cast<size_t> (priority)].push_back (ReadyMailbox {subscription, &mailbox, mailbox.ticket});
+	}
+
+	if (priority == EventPriority::High)
+		highLaneCondition.notify_one ();
+	deliveriesCondition.notify_one ();
+}
+
+
+
+
+size_t EventManager::deliver (Subscription &subscription, size_t replica, const PendingEvent *objects, size_t count) {
+	bool tracing	= latencyTracing;
+
+	const auto &handler			= subscription.replicaHandlers.empty () ? subscription.handler : subscription.replicaHandlers[replica].first;
+	const auto &batchHandler	= subscription.replicaHandlers.empty () ? subscription.batchHandler : subscription.replicaHandlers[replica].second;
+
+	// A failing batch is stored as a whole, since there is no way to know which payload made it fail
+	if (batchHandler) {
+		std::vector<SharedEventObject> batch;
+		batch.reserve (count);
+		for (size_t i=0; i<count; i++)
+			batch.push_back (objects[i].object);
+
+		int64_t start	= tracing ? utils::steadyNanoseconds () : 0;
+		try {
+			batchHandler (batch);
+		} catch (...) {
+			handlerFailed (subscription, objects, count);
+		}
+
+		if (tracing) {
+			int64_t finish	= utils::steadyNanoseconds ();
+			for (size_t i=0; i<count; i++)
+				recordLatency (objects[i].event, subscription.id, objects[i].enqueued ? start - objects[i].enqueued : -1,
+							   i == 0 ? finish - start : -1);
+		}
+
+		return count;
+	}
+
+	size_t handled	= 0;
+	for (size_t i=0; i<count; i++) {
+		// Payloads still in hand when the subscription is suspended are discarded
+		if (subscription.suspended)
+			break;
+
+		int64_t start	= tracing ? utils::steadyNanoseconds () : 0;
+		try {
+			handler (objects[i].event, objects[i].object);
+		} catch (...) {
+			handlerFailed (subscription, &objects[i], 1);
+		}
+		handled++;
+
+		if (tracing)
+			recordLatency (objects[i].event, subscription.id, objects[i].enqueued ? start - objects[i].enqueued : -1,
+						   utils::steadyNanoseconds () - start);
+	}
+
+	return handled;
+}
+
+
+
+
+/**
+ * \brief Histograms of a thread for each manager it recorded for, by generation of the manager. When the thread exits,
+ * they are folded in the retired histograms of managers still existing, so exited threads are not kept
+ */
+struct EventManager::ThreadRecorders {
+	struct Recorder {
+		std::weak_ptr<LatencyRecords> records;
+		std::shared_ptr<ThreadLatencies> latencies;
+	};
+
+	std::map<uint64_t, Recorder> recorders;
+	uint64_t lastGeneration;
+	ThreadLatencies *last;
+
+	ThreadRecorders () : lastGeneration (0), last (nullptr) {}
+
+	~ThreadRecorders () {
+		for (auto &recorder : recorders) {
+			std::shared_ptr<LatencyRecords> records	= recorder.second.records.lock ();
+			if (!records)
+				continue;
+
+			// Only this thread changes its histograms, so reading them needs no lock
+			std::unique_lock<std::mutex> lock (records->mutex);
+			auto &threads	= records->threads;
+			threads.erase (std::remove (threads.begin (), threads.end (), recorder.second.latencies), threads.end ());
+
+			for (auto &histograms : recorder.second.latencies->histograms) {
+				auto it	= records->retired.find (histograms.first);
+				if (it == records->retired.end ()) {
+					it						= records->retired.emplace (histograms.first, LatencyStats ()).first;
+					it->second.event		= histograms.first.first;
+					it->second.subscription	= histograms.first.second;
+				}
+
+				it->second.queue.merge (histograms.second->queue);
+				it->second.handler.merge (histograms.second->handler);
+			}
+		}
+	}
+};
+
+
+
+
+void EventManager::recordLatency (EventId event, SubscriptionId subscription, int64_t queueLatency, int64_t handlerLatency) {
+	// Each thread registers its histograms once for each manager it works for
+	static thread_local ThreadRecorders recorders;
+
+	if (recorders.lastGeneration != generation) {
+		auto recorderIt	= recorders.recorders.find (generation);
+		if (recorderIt == recorders.recorders.end ()) {
+			// Histograms of destroyed managers are dropped
+			for (auto it=recorders.recorders.begin (); it!=recorders.recorders.end (); ) {
+				if (it->second.records.expired ())
+					it	= recorders.recorders.erase (it);
+				else
+					++it;
+			}
+
+			ThreadRecorders::Recorder recorder {latencyRecords, std::make_shared<ThreadLatencies> ()};
+			{
+				std::unique_lock<std::mutex> lock (latencyRecords->mutex);
+				latencyRecords->threads.push_back (recorder.latencies);
+			}
+			recorderIt	= recorders.recorders.emplace (generation, recorder).first;
+		}
+
+		recorders.lastGeneration	= generation;
+		recorders.last				= recorderIt->second.latencies.get ();
+	}
+
+	ThreadLatencies *latencies	= recorders.last;
+
+	// Only this thread changes the map, so looking it up needs no lock
+	auto key	= std::make_pair (event, subscription);
+	auto it		= latencies->histograms.find (key);
+	if (it == latencies->histograms.end ()) {
+		std::unique_lock<std::mutex> lock (latencies->mutex);
+		it	= latencies->histograms.emplace (key, std::unique_ptr<ThreadLatencies::Histograms> (new ThreadLatencies::Histograms ())).first;
+	}
+
+	if (queueLatency >= 0)
+		it->second->queue.record (queueLatency);
+	if (handlerLatency >= 0)
+		it->second->handler.record (handlerLatency);
+}
+
+
+
+
+void EventManager::deliverInline (Subscription &subscription, EventId event, const EventOptions &eventOptions,
+								  const SharedEventObject *objects, size_t count) {
+	// The common single payload is handed over without allocating
+	int64_t enqueued	= latencyTracing ? utils::steadyNanoseconds () : 0;
+	PendingEvent single {event, objects[0], enqueued};
+	std::vector<PendingEvent> pending;
+	if (count > 1) {
+		pending.reserve (count);
+		for (size_t i=0; i<count; i++)
+			pending.push_back (PendingEvent {event, objects[i], enqueued});
+	}
+
+	insideInlineHandler		= true;
+	auto start				= std::chrono::steady_clock::now ();
+	size_t handled			= deliver (subscription, 0, count > 1 ? pending.data () : &single, count);
+	auto elapsed			= std::chrono::steady_clock::now () - start;
+	insideInlineHandler		= false;
+
+	Mailbox &mailbox	= *subscription.mailboxes.front ();
+	mailbox.delivered	+= handled;
+	mailbox.dropped		+= count - handled;
+
+	// A slow handler would delay its publishers: from now on its payloads go to dispatchers
+	if (elapsed > std::chrono::microseconds (subscription.options.inlineBudget) * count)
+		subscription.inlined	= false;
+}
+
+
+
+
+void EventManager::handlerFailed (Subscription &subscription, const PendingEvent *objects, size_t count) {
+	std::string error	= "Unknown exception";
+	try {
+		throw;
+	} catch (std::exception &e) {
+		error	= e.what ();
+	} catch (...) {
+	}
+
+	subscription.failed	+= count;
+
+	// Failures take tokens at the tolerated rate: when a subscriber fails faster, it is suspended
+	if (subscription.failureBudget && !subscription.failureBudget->tryAcquire (utils::steadyNanoseconds ()))
+		subscription.suspended	= true;
+
+	auto now	= std::chrono::system_clock::now ();
+
+	std::unique_lock<std::mutex> lock (deadLettersMutex);
+	for (size_t i=0; i<count; i++) {
+		if (deadLetters.size () == deadLetterCapacity)
+			deadLetters.pop_front ();
+		deadLetters.push_back (DeadLetter {subscription.id, objects[i].event, objects[i].object, error, now});
+	}
+}
+
+
+
+
+bool EventManager::needsJson (const Subscription &subscription, const EventObject &object) {
+	return !subscription.options.filter.isEmpty () || subscription.options.partitionKey || !subscription.objectType ||
+		   *subscription.objectType != object.type ();
+}
+
+
+
+
+void EventManager::checkJson (const EventTable &table, const EventEntry &entry, const EventObject &object) {
+	std::string reason;
+	if (entry.options.journaled && table.journal)
+		reason	= "it is journaled";
+
+	for (size_t i=0; i<entry.subscribers.size () && reason.empty (); i++) {
+		if (needsJson (*entry.subscribers[i], object))
+			reason	= "subscription " + std::to_string (entry.subscribers[i]->id) + " needs payloads as json";
+	}
+
+	if (!reason.empty ())
+		throw exceptions::EventManagerException ("Cannot trigger event \"" + entry.service + "/" + entry.name + "\" with an object of type " +
+												 object.type ().name () + ", which has no JsonConverter: " + reason);
+}
+
+
+
+
+void EventManager::dispatchEvent (EventId event, SharedEventObject object, bool admitted) {
+	std::shared_ptr<utils::EventJournal> journal;
+	uint64_t offset	= 0;
+	std::chrono::nanoseconds delay (0);
+	std::vector<DeferredPayloads> deferred;
+	{
+		auto table				= eventTable.read ();
+		const EventEntry &entry	= getEntry (*table, event);
+
+		if (!entry.registered)
+			throw exceptions::EventManagerException ("Event \"" + entry.service + "/" + entry.name + "\" is not registered");
+
+		if (!object->hasJson ())
+			checkJson (*table, entry, *object);
+
+		if (!admitted && (entry.rateLimiter || entry.serviceRateLimiter) && admit (entry, 1, delay) == 0)
+			return;
+
+		if (delay.count () == 0) {
+			if (journalEvent (*table, entry, object, offset))
+				journal	= table->journal;
+
+			uint64_t sequence	= 0;
+			if (entry.options.sticky) {
+				std::unique_lock<std::mutex> lock (entry.runtime->mutex);
+				entry.runtime->lastValue	= object;
+				sequence					= ++entry.runtime->sequence;
+			}
+
+			for (auto &subscription : entry.subscribers)
+				enqueue (subscription, event, entry.options, &object, sequence ? &sequence : nullptr, 1, &deferred);
+		}
+	}
+
+	// A delayed publisher waits for its token without holding the table, then delivers with the table of that moment
+	if (delay.count () > 0) {
+		std::this_thread::sleep_for (delay);
+		dispatchEvent (event, object, true);
+		return;
+	}
+
+	// Likewise, a publisher waits for room in full queues only after releasing the table, so it never delays writers
+	enqueueDeferred (deferred);
+
+	// Waiting for the disk after releasing the table does not delay its writers
+	if (journal && journal->getOptions ().waitDurable)
+		journal->sync (offset);
+}
+
+
+
+
+void EventManager::dispatchEvents (const std::vector<std::pair<EventId, SharedEventObject>> &events, bool admitted) {
+	std::shared_ptr<utils::EventJournal> journal;
+	uint64_t offset	= 0;
+	std::chrono::nanoseconds delay (0);
+	std::vector<std::pair<EventId, SharedEventObject>> admittedEvents;
+	std::vector<DeferredPayloads> deferred;
+	bool limited	= false;
+	{
+		auto table	= eventTable.read ();
+
+		// Payloads are grouped by event keeping their order, and all events are checked before delivering anything
+		std::map<EventId, std::pair<const EventEntry *, std::vector<SharedEventObject>>> batches;
+		for (auto &event : events) {
+			auto &batch	= batches[event.first];
+			if (!batch.first) {
+				batch.first	= &getEntry (*table, event.first);
+
+				if (!batch.first->registered)
+					throw exceptions::EventManagerException ("Event \"" + batch.first->service + "/" + batch.first->name + "\" is not registered");
+			}
+			batch.second.push_back (event.second);
+		}
+
+		// Tokens for all payloads of an event are taken at once. If some payloads are dropped or delayed, the admitted
+		// ones are delivered by a second pass, keeping their order
+		if (!admitted) {
+			for (auto &batch : batches) {
+				const EventEntry &entry					= *batch.second.first;
+				std::vector<SharedEventObject> &objects	= batch.second.second;
+				if (!entry.rateLimiter && !entry.serviceRateLimiter)
+					continue;
+
+				size_t count	= admit (entry, objects.size (), delay);
+				if (count < objects.size ()) {
+					objects.resize (count);
+					limited	= true;
+				}
+			}
+
+			if (limited || delay.count () > 0) {
+				limited	= true;
+
+				std::map<EventId, size_t> taken;
+				for (auto &event : events) {
+					if (taken[event.first]++ < batches[event.first].second.size ())
+						admittedEvents.push_back (event);
+				}
+			}
+		}
+
+		if (!limited) {
+			// Records follow the order of "events", and a single sync makes all of them durable
+			for (auto &event : events) {
+				if (journalEvent (*table, *batches[event.first].first, event.second, offset))
+					journal	= table->journal;
+			}
+
+			for (auto &batch : batches) {
+				const EventEntry &entry							= *batch.second.first;
+				const std::vector<SharedEventObject> &objects	= batch.second.second;
+
+				std::vector<uint64_t> sequences;
+				if (entry.options.sticky) {
+					std::unique_lock<std::mutex> lock (entry.runtime->mutex);
+					entry.runtime->lastValue	= objects.back ();
+					for (size_t i=0; i<objects.size (); i++)
+						sequences.push_back (++entry.runtime->sequence);
+				}
+
+				for (auto &subscription : entry.subscribers)
+					enqueue (subscription, batch.first, entry.options, objects.data (), sequences.empty () ? nullptr : sequences.data (), objects.size (),
+							 &deferred);
+			}
+		}
+	}
+
+	if (limited) {
+		if (delay.count () > 0)
+			std::this_thread::sleep_for (delay);
+		if (!admittedEvents.empty ())
+			dispatchEvents (admittedEvents, true);
+		return;
+	}
+
+	enqueueDeferred (deferred);
+
+	if (journal && journal->getOptions ().waitDurable)
+		journal->sync (offset);
+}
+
+
+
+
+size_t EventManager::admit (const EventEntry &entry, size_t count, std::chrono::nanoseconds &delay) {
+	int64_t now						= utils::steadyNanoseconds ();
+	RateLimiter *const limiters[]	= {entry.rateLimiter.get (), entry.serviceRateLimiter.get ()};
+	size_t offered[2];								// Payloads each limit is asked for
+	size_t taken[2];
+	int64_t waits[]					= {0, 0};
+
+	// Tokens are taken from both limits before updating any counter, since payloads dropped by the limit of the service
+	// must not consume nor be counted by the limit of the event
+	for (int i=0; i<2; i++) {
+		RateLimiter *limiter	= limiters[i];
+		offered[i]				= count;
+		taken[i]				= count;
+		if (!limiter || count == 0)
+			continue;
+
+		// Waiting on a dispatcher or on the timer thread would stall other work, so there delayed payloads are dropped
+		if (limiter->limit.policy == RateLimitPolicy::Delay && !insideDispatcher && !insideTimer) {
+			waits[i]	= limiter->bucket.reserve (now, count);
+			continue;
+		}
+
+		taken[i]	= 0;
+		while (taken[i] < count && limiter->bucket.tryAcquire (now))
+			taken[i]++;
+		count	= taken[i];
+	}
+
+	if (limiters[0] && taken[0] > count)
+		limiters[0]->bucket.refund (taken[0] - count);
+
+	for (int i=0; i<2; i++) {
+		RateLimiter *limiter	= limiters[i];
+		if (!limiter)
+			continue;
+
+		limiter->admitted	+= count;
+		limiter->dropped	+= offered[i] - taken[i];
+		if (waits[i] > 0 && count > 0) {
+			delay	= std::max (delay, std::chrono::nanoseconds (waits[i]));
+			limiter->delayed	+= count;
+		}
+	}
+
+	return count;
+}
+
+
+
+
+std::shared_ptr<EventManager::RateLimiter> EventManager::makeRateLimiter (const RateLimit &limit) {
+	if (limit.rate == 0)
+		return nullptr;
+
+	if (!utils::TokenBucket::isValid (limit.rate, limit.burst))
+		throw exceptions::EventManagerException ("Rate limits need a rate between 0 and 1e9 payloads per second and a burst of at "
+												 "least one payload, produced in less than " +
+												 std::to_string (utils::TokenBucket::maxWindow / 1000000000) + " seconds");
+
+	return std::make_shared<RateLimiter> (limit);
+}
+
+
+
+
+RateLimitStats EventManager::statsOf (const std::shared_ptr<RateLimiter> &limiter) {
+	RateLimitStats stats {0, 0, 0};
+
+	if (limiter) {
+		stats.admitted	= limiter->admitted;
+		stats.dropped	= limiter->dropped;
+		stats.delayed	= limiter->delayed;
+	}
+
+	return stats;
+}
+
+
+
+
+void EventManager::setServiceRateLimit (std::string service, RateLimit limit) {
+	std::shared_ptr<RateLimiter> limiter	= makeRateLimiter (limit);
+
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	if (limiter)
+		serviceRateLimiters[service]	= limiter;
+	else
+		serviceRateLimiters.erase (service);
+
+	// Events interned later take the limiter from "serviceRateLimiters"
+	const EventTable *table	= eventTable.get ();
+	auto serviceIt			= table->names->find (service);
+	if (serviceIt == table->names->end ())
+		return;
+
+	std::unique_ptr<EventTable> newTable (new EventTable (*table));
+	for (auto &event : serviceIt->second) {
+		EventEntry *newEntry			= new EventEntry (*table->events[event.second]);
+		newEntry->serviceRateLimiter	= limiter;
+		newTable->events.set (event.second, std::shared_ptr<const EventEntry> (newEntry));
+	}
+
+	eventTable.publish (newTable.release ());
+}
+
+
+
+
+RateLimitStats EventManager::getRateLimitStats (EventId event) {
+	auto table	= eventTable.read ();
+
+	return statsOf (getEntry (*table, event).rateLimiter);
+}
+
+
+
+
+RateLimitStats EventManager::getServiceRateLimitStats (std::string service) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	auto it	= serviceRateLimiters.find (service);
+	return statsOf (it == serviceRateLimiters.end () ? nullptr : it->second);
+}
+
+
+
+
+bool EventManager::journalEvent (const EventTable &table, const EventEntry &entry, const SharedEventObject &object, uint64_t &offset) {
+	if (!entry.options.journaled || !table.journal)
+		return false;
+
+	static const Json::StreamWriterBuilder writerBuilder	= [] {
+		Json::StreamWriterBuilder builder;
+		builder["indentation"]	= "";
+		return builder;
+	} ();
+
+	offset	= table.journal->append (entry.service, entry.name, Json::writeString (writerBuilder, object->asJson ()));
+	return true;
+}
+
+
+
+
+void EventManager::unsubscribe (SubscriptionId subscription) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	auto it	= subscriptions.find (subscription);
+	if (it == subscriptions.end ())
+		throw exceptions::EventManagerException ("Unknown subscription " + std::to_string (subscription));
+
+	std::unique_ptr<EventTable> newTable (new EventTable (*eventTable.get ()));
+	cancelSubscription (*newTable, it->second);
+
+	eventTable.publish (newTable.release ());
+}
+
+
+
+
+SubscriptionStats EventManager::getSubscriptionStats (SubscriptionId subscription) {
+	std::shared_ptr<Subscription> s;
+	{
+		std::unique_lock<std::mutex> lock (tableMutex);
+		auto it	= subscriptions.find (subscription);
+		if (it == subscriptions.end ())
+			throw exceptions::EventManagerException ("Unknown subscription " + std::to_string (subscription));
+		s	= it->second;
+	}
+
+	SubscriptionStats stats;
+	stats.queueDepth	= 0;
+	stats.queueCapacity	= s->options.queueCapacity * s->mailboxes.size ();
+	stats.delivered		= 0;
+	stats.dropped		= 0;
+	stats.coalesced		= 0;
+	stats.conflated		= 0;
+	stats.filtered		= 0;
+	stats.failed		= s->failed;
+	stats.suspended		= s->suspended;
+	stats.inlined		= s->inlined;
+
+	for (auto &mailbox : s->mailboxes) {
+		{
+			std::unique_lock<std::mutex> lock (mailbox->mutex);
+			stats.queueDepth	+= mailbox->size ();
+		}
+		stats.delivered		+= mailbox->delivered;
+		stats.dropped		+= mailbox->dropped;
+		stats.coalesced		+= mailbox->coalesced;
+		stats.conflated		+= mailbox->conflated;
+		stats.filtered		+= mailbox->filtered;
+	}
+
+	return stats;
+}
+
+
+
+
+void EventManager::resumeSubscription (SubscriptionId subscription) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	auto it	= subscriptions.find (subscription);
+	if (it == subscriptions.end ())
+		throw exceptions::EventManagerException ("Unknown subscription " + std::to_string (subscription));
+
+	it->second->suspended	= false;
+}
+
+
+
+
+std::vector<DeadLetter> EventManager::takeDeadLetters () {
+	std::unique_lock<std::mutex> lock (deadLettersMutex);
+
+	std::vector<DeadLetter> result (std::make_move_iterator (deadLetters.begin ()), std::make_move_iterator (deadLetters.end ()));
+	deadLetters.clear ();
+
+	return result;
+}
+
+
+
+
+void EventManager::setLatencyTracing (bool enabled) {
+	latencyTracing	= enabled;
+}
+
+
+
+
+std::vector<LatencyStats> EventManager::getLatencyStats () {
+	// The lock keeps exiting threads from moving their histograms to the retired ones while they are merged
+	std::unique_lock<std::mutex> recordsLock (latencyRecords->mutex);
+	std::map<std::pair<EventId, SubscriptionId>, LatencyStats> merged	= latencyRecords->retired;
+
+	// Histograms are merged while their threads go on recording
+	for (auto &thread : latencyRecords->threads) {
+		std::unique_lock<std::mutex> lock (thread->mutex);
+
+		for (auto &histograms : thread->histograms) {
+			auto it	= merged.find (histograms.first);
+			if (it == merged.end ()) {
+				it						= merged.emplace (histograms.first, LatencyStats ()).first;
+				it->second.event		= histograms.first.first;
+				it->second.subscription	= histograms.first.second;
+			}
+
+			it->second.queue.merge (histograms.second->queue);
+			it->second.handler.merge (histograms.second->handler);
+		}
+	}
+	recordsLock.unlock ();
+
+	std::vector<LatencyStats> result;
+	result.reserve (merged.size ());
+	for (auto &stats : merged)
+		result.push_back (stats.second);
+
+	return result;
+}
+
+
+
+
+void EventManager::serviceJoin (std::string serviceName) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	// While a service is reloaded, its new instance joins before the old one leaves
+	unsigned &instances	= joinedServices[serviceName];
+	auto replicatedIt	= replicatedServices.find (serviceName);
+	unsigned allowed	= replicatedIt != replicatedServices.end () ? replicatedIt->second.options.replicas : 1;
+	if (instances >= allowed && reloadingServices.find (serviceName) == reloadingServices.end ())
+		throw exceptions::EventManagerException ("Service \"" + serviceName + "\" already joined");
+
+	instances++;
+}
+
+
+
+
+void EventManager::serviceLeave (std::string serviceName) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	auto joinedIt	= joinedServices.find (serviceName);
+	if (joinedIt == joinedServices.end ())
+		throw exceptions::EventManagerException ("Service \"" + serviceName + "\" never joined");
+
+	// An instance replaced by a reload leaves events and subscriptions to the new one
+	if (--joinedIt->second > 0)
+		return;
+	joinedServices.erase (joinedIt);
+
+	// Only events and subscriptions of this service are looked at, through names and the reverse index
+	const EventTable *table	= eventTable.get ();
+	auto serviceIt			= table->names->find (serviceName);
+	auto ownedIt			= ownedSubscriptions.find (serviceName);
+	if (serviceIt == table->names->end () && ownedIt == ownedSubscriptions.end ())
+		return;
+
+	std::unique_ptr<EventTable> newTable (new EventTable (*table));
+
+	// Subscriptions to events of this service are kept: they will be served again when the service joins back.
+	// Cached payloads are not, since they describe the state of the service which left
+	if (serviceIt != table->names->end ()) {
+		for (auto &event : serviceIt->second) {
+			EventEntry *newEntry			= new EventEntry (*table->events[event.second]);
+			newEntry->registered			= false;
+			newTable->events.set (event.second, std::shared_ptr<const EventEntry> (newEntry));
+
+			std::unique_lock<std::mutex> runtimeLock (newEntry->runtime->mutex);
+			newEntry->runtime->lastValue.reset ();
+		}
+	}
+
+	// Placeholders of a lazy service belong to the registry, and wait for its next activation
+	if (ownedIt != ownedSubscriptions.end ()) {
+		std::set<SubscriptionId> owned	= ownedIt->second;
+		for (SubscriptionId id : owned) {
+			if (!subscriptions[id]->activation)
+				cancelSubscription (*newTable, subscriptions[id]);
+		}
+	}
+
+	eventTable.publish (newTable.release ());
+}
+
+
+
+
+void EventManager::holdSubscriptions (std::string serviceName) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	if (!reloadingServices.emplace (serviceName, std::vector<StandbySubscription> ()).second)
+		throw exceptions::EventManagerException ("Service \"" + serviceName + "\" is already being reloaded");
+}
+
+
+
+
+void EventManager::pauseSubscriptions (std::string serviceName) {
+	std::vector<std::shared_ptr<Subscription>> previous;
+	{
+		std::unique_lock<std::mutex> lock (tableMutex);
+
+		auto reloadIt	= reloadingServices.find (serviceName);
+		auto ownedIt	= ownedSubscriptions.find (serviceName);
+		if (reloadIt == reloadingServices.end ())
+			throw exceptions::EventManagerException ("Service \"" + serviceName + "\" is not being reloaded");
+		if (ownedIt == ownedSubscriptions.end ())
+			return;
+
+		for (SubscriptionId id : ownedIt->second) {
+			std::shared_ptr<Subscription> &subscription	= subscriptions[id];
+			if (!subscription->paused) {
+				subscription->paused	= true;
+				previous.push_back (subscription);
+			}
+		}
+	}
+
+	// A dispatcher which took a mailbox before the pause either sees it, or has marked the mailbox as draining. Likewise,
+	// a publisher handling payloads inline either sees the pause or is counted among "inlineDeliveries"
+	for (auto &subscription : previous) {
+		while (subscription->inlineDeliveries > 0)
+			std::this_thread::yield ();
+
+		for (auto &mailbox : subscription->mailboxes) {
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock (mailbox->mutex);
+					if (!mailbox->draining)
+						break;
+				}
+				std::this_thread::yield ();
+			}
+		}
+	}
+}
+
+
+
+
+std::vector<std::weak_ptr<const void>> EventManager::swapSubscriptions (std::string serviceName, bool commit) {
+	std::vector<StandbySubscription> standby;
+	std::vector<std::shared_ptr<Subscription>> previous;
+
+	// Each subscription of the old instance hands its payloads to the standby one with the same event, pattern or endpoint
+	std::vector<std::pair<std::shared_ptr<Subscription>, std::shared_ptr<Subscription>>> successors;
+	{
+		std::unique_lock<std::mutex> lock (tableMutex);
+
+		auto reloadIt	= reloadingServices.find (serviceName);
+		if (reloadIt == reloadingServices.end ())
+			throw exceptions::EventManagerException ("Service \"" + serviceName + "\" is not being reloaded");
+
+		std::set<SubscriptionId> standbyIds;
+		for (auto &s : reloadIt->second) {
+			if (!s.subscription->cancelled)
+				standby.push_back (s);
+			standbyIds.insert (s.subscription->id);
+		}
+
+		auto ownedIt	= ownedSubscriptions.find (serviceName);
+		if (ownedIt != ownedSubscriptions.end ()) {
+			for (SubscriptionId id : ownedIt->second) {
+				if (standbyIds.find (id) == standbyIds.end ())
+					previous.push_back (subscriptions[id]);
+			}
+		}
+
+		// The new table is built before anything else changes: if it fails, the service is still being reloaded and
+		// the reload can be aborted
+		const EventTable *table	= eventTable.get ();
+		std::unique_ptr<EventTable> newTable (new EventTable (*table));
+		std::vector<std::shared_ptr<Subscription>> cancelled;
+
+		if (commit) {
+			std::map<std::string, std::deque<std::shared_ptr<Subscription>>> routes;
+			for (auto &s : standby)
+				routes[routeOf (*s.subscription, s.event, s.responder)].push_back (s.subscription);
+
+			for (auto &subscription : previous) {
+				EventId event	= subscription->events.empty () ? 0 : subscription->events.front ();
+				bool responder	= !subscription->events.empty () && table->events[event]->responder == subscription;
+
+				auto &route	= routes[routeOf (*subscription, event, responder)];
+				if (!route.empty ()) {
+					successors.emplace_back (subscription, route.front ());
+					route.pop_front ();
+				}
+
+				detachSubscription (*newTable, subscription);
+			}
+
+			size_t attached	= 0;
+			try {
+				for (; attached<standby.size (); attached++)
+					attachSubscription (*newTable, standby[attached]);
+			} catch (...) {
+				for (size_t i=0; i<=attached && i<standby.size (); i++) {
+					const std::shared_ptr<Subscription> &subscription	= standby[i].subscription;
+					subscription->events.clear ();
+					if (!subscription->pattern.empty ())
+						patternSubscriptions.remove (subscription->pattern, subscription);
+				}
+				throw;
+			}
+
+			cancelled	= previous;
+		}
+		else {
+			// Standby subscriptions are in no entry yet
+			for (auto &s : standby)
+				cancelled.push_back (s.subscription);
+		}
+
+		reloadingServices.erase (reloadIt);
+		for (auto &subscription : cancelled)
+			forgetSubscription (subscription);
+
+		eventTable.publish (newTable.release ());
+	}
+
+	if (!commit) {
+		for (auto &subscription : previous)
+			resumeDelivery (subscription);
+		return std::vector<std::weak_ptr<const void>> ();
+	}
+
+	// Publishers already reach the new subscriptions, which stay paused until buffered payloads are put before theirs
+	for (auto &successor : successors)
+		movePending (*successor.first, *successor.second);
+
+	for (auto &s : standby) {
+		if (s.subscription->options.lastValue && s.subscription->pattern.empty () && !s.responder)
+			deliverLastValue (s.subscription, s.event);
+		resumeDelivery (s.subscription);
+	}
+
+	// Cancelled subscriptions drain, without handling them, payloads enqueued by publishers which saw the old table
+	std::vector<std::weak_ptr<const void>> replaced;
+	for (auto &subscription : previous) {
+		resumeDelivery (subscription);
+		replaced.push_back (subscription);
+	}
+
+	return replaced;
+}
+
+
+
+
+void EventManager::armActivation (std::string serviceName, std::vector<std::string> events, std::vector<std::string> endpoints,
+								  std::function<void ()> activate) {
+	// A service which cannot start must not stall its publishers
+	SubscriptionOptions options;
+	options.owner			= serviceName;
+	options.backpressure	= BackpressurePolicy::DropOldest;
+
+	auto placeholder	= [&] () {
+		std::shared_ptr<Subscription> subscription	= std::make_shared<Subscription> ();
+		subscription->options						= options;
+		subscription->handler						= [] (EventId, const SharedEventObject &) {};
+		subscription->activation					= activate;
+		subscription->paused						= true;
+		return subscription;
+	};
+
+	for (auto &event : events) {
+		if (event.find ('*') != std::string::npos) {
+			subscribePattern (event, placeholder ());
+			continue;
+		}
+
+		size_t separator	= event.find ('/');
+		if (separator == std::string::npos)
+			throw exceptions::EventManagerException ("\"" + event + "\" is neither a topic nor a pattern");
+		subscribe (getEventId (event.substr (0, separator), event.substr (separator + 1)), placeholder ());
+	}
+
+	for (auto &endpoint : endpoints)
+		subscribeResponder (getEventId (serviceName, endpoint), placeholder ());
+}
+
+
+
+
+uint64_t EventManager::getServiceActivity (std::string serviceName) {
+	std::vector<std::shared_ptr<Subscription>> owned;
+	{
+		std::unique_lock<std::mutex> lock (tableMutex);
+
+		auto ownedIt	= ownedSubscriptions.find (serviceName);
+		if (ownedIt != ownedSubscriptions.end ()) {
+			for (SubscriptionId id : ownedIt->second) {
+				if (!subscriptions[id]->activation)
+					owned.push_back (subscriptions[id]);
+			}
+		}
+	}
+
+	// Payloads still queued count as well, so an event which is waiting keeps the service active
+	uint64_t activity	= 0;
+	for (auto &subscription : owned) {
+		for (auto &mailbox : subscription->mailboxes) {
+			std::unique_lock<std::mutex> lock (mailbox->mutex);
+			activity	+= mailbox->delivered + mailbox->dropped + mailbox->size ();
+		}
+	}
+
+	return activity;
+}
+
+
+
+
+void EventManager::setReplicas (std::string serviceName, ReplicaOptions options) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	if (options.replicas <= 1) {
+		replicatedServices.erase (serviceName);
+		return;
+	}
+
+	if (options.balance == BalancePolicy::KeyAffinity && !options.affinityKey)
+		throw exceptions::EventManagerException ("Replicas of service \"" + serviceName + "\" need a key to be balanced by affinity");
+
+	unsigned replicas				= options.replicas;
+	replicatedServices[serviceName]	= ReplicatedService {std::move (options), replicas, {}, {}};
+}
+
+
+
+
+void EventManager::joinReplica (std::string serviceName, unsigned replica) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	auto replicatedIt	= replicatedServices.find (serviceName);
+	if (replicatedIt == replicatedServices.end ())
+		return;
+
+	ReplicatedService &replicated	= replicatedIt->second;
+	unsigned expected				= replicated.joining == replicated.options.replicas ? 0 : replicated.joining + 1;
+	if (replica != expected)
+		throw exceptions::EventManagerException ("Replica " + std::to_string (replica) + " of service \"" + serviceName + "\" joined out of order");
+
+	replicated.joining	= replica;
+}
+
+
+
+
+void EventManager::completeReplicas (std::string serviceName) {
+	std::vector<std::shared_ptr<Subscription>> groups;
+	{
+		std::unique_lock<std::mutex> lock (tableMutex);
+
+		auto replicatedIt	= replicatedServices.find (serviceName);
+		if (replicatedIt == replicatedServices.end ())
+			return;
+
+		ReplicatedService &replicated	= replicatedIt->second;
+		replicated.joining				= replicated.options.replicas;
+
+		// Cancelled groups are not delivered anymore, whoever joined them
+		for (auto &group : replicated.groups) {
+			if (group.second->cancelled)
+				continue;
+			if (group.second->joinedReplicas != replicated.options.replicas)
+				throw exceptions::EventManagerException ("Not all replicas of service \"" + serviceName + "\" subscribed to " + group.first.first);
+			groups.push_back (group.second);
+		}
+	}
+
+	for (auto &group : groups)
+		resumeDelivery (group);
+}
+
+
+
+
+EventId EventManager::registerEvent (std::string serviceName, std::string eventName, EventOptions options) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	if (joinedServices.find (serviceName) == joinedServices.end ())
+		throw exceptions::EventManagerException ("Service \"" + serviceName + "\" is not joined");
+
+	std::shared_ptr<RateLimiter> limiter	= makeRateLimiter (options.rateLimit);
+	EventId id								= internEvent (serviceName, eventName);
+
+	// The new instance of a reloaded service registers again events of the old one, as replicas do with each other
+	bool reloading	= reloadingServices.find (serviceName) != reloadingServices.end () ||
+					  replicatedServices.find (serviceName) != replicatedServices.end ();
+
+	updateEntry (id, [&] (EventEntry &entry) {
+		if (entry.registered && !reloading)
+			throw exceptions::EventManagerException ("Event \"" + serviceName + "/" + eventName + "\" already registered");
+		entry.registered	= true;
+		entry.options		= options;
+		entry.rateLimiter	= limiter;
+	});
+
+	return id;
+}
+
+
+
+
+EventId EventManager::getEventId (std::string service, std::string eventName) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	return internEvent (service, eventName);
+}
+
+
+
+
+SubscriptionId EventManager::onEvent (EventId event, EventHandler handler, SubscriptionOptions options) {
+	if (!handler)
+		throw exceptions::EventManagerException ("Empty handler for event " + std::to_string (event));
+
+	// Legacy handlers receive their own copy of the payload
+	return onEvent (event, SharedEventHandler ([handler] (SharedPayload payload) {
+		handler (*payload);
+	}), options);
+}
+
+
+
+
+SubscriptionId EventManager::onEvent (EventId event, SharedEventHandler handler, SubscriptionOptions options) {
+	if (!handler)
+		throw exceptions::EventManagerException ("Empty handler for event " + std::to_string (event));
+
+	std::shared_ptr<Subscription> subscription	= std::make_shared<Subscription> ();
+	subscription->options						= options;
+
+	// The json form shares ownership with the event object, so typed payloads are converted only here
+	subscription->handler	= [handler] (EventId, const SharedEventObject &object) {
+		handler (SharedPayload (object, &object->asJson ()));
+	};
+
+	return subscribe (event, subscription);
+}
+
+
+
+
+SubscriptionId EventManager::onEvent (EventId event, BatchEventHandler handler, SubscriptionOptions options) {
+	if (!handler)
+		throw exceptions::EventManagerException ("Empty handler for event " + std::to_string (event));
+
+	std::shared_ptr<Subscription> subscription	= std::make_shared<Subscription> ();
+	subscription->options						= options;
+
+	subscription->batchHandler	= [handler] (const std::vector<SharedEventObject> &objects) {
+		std::vector<SharedPayload> payloads;
+		payloads.reserve (objects.size ());
+		for (auto &object : objects)
+			payloads.push_back (SharedPayload (object, &object->asJson ()));
+
+		handler (payloads);
+	};
+
+	return subscribe (event, subscription);
+}
+
+
+
+
+SubscriptionId EventManager::onEvent (std::string service, std::string eventName, EventHandler handler, SubscriptionOptions options) {
+	return onEvent (getEventId (service, eventName), handler, options);
+}
+
+
+
+
+SubscriptionId EventManager::onEvent (std::string service, std::string eventName, SharedEventHandler handler,
+									  SubscriptionOptions options) {
+	return onEvent (getEventId (service, eventName), handler, options);
+}
+
+
+
+
+void EventManager::triggerEvent (EventId event, SharedPayload payload) {
+	if (!payload)
+		throw exceptions::EventManagerException ("Empty payload for event " + std::to_string (event));
+
+	dispatchEvent (event, std::make_shared<const JsonEventObject> (payload));
+}
+
+
+
+
+void EventManager::triggerEvent (EventId event, Json::Value &payload) {
+	// The payload is copied once and then shared by all subscribers
+	triggerEvent (event, std::make_shared<const Json::Value> (payload));
+}
+
+
+
+
+void EventManager::triggerEvent (EventId event, Json::Value &&payload) {
+	triggerEvent (event, std::make_shared<const Json::Value> (std::move (payload)));
+}
+
+
+
+
+void EventManager::triggerEvent (std::string service, std::string eventName, Json::Value &payload) {
+	EventId event;
+	{
+		auto table		= eventTable.read ();
+		auto serviceIt	= table->names->find (service);
+		if (serviceIt == table->names->end ())
+			throw exceptions::EventManagerException ("Event \"" + service + "/" + eventName + "\" is not registered");
+
+		auto idIt	= serviceIt->second.find (eventName);
+		if (idIt == serviceIt->second.end ())
+			throw exceptions::EventManagerException ("Event \"" + service + "/" + eventName + "\" is not registered");
+
+		event	= idIt->second;
+	}
+
+	triggerEvent (event, payload);
+}
+
+
+
+
+void EventManager::triggerEvents (EventId event, std::vector<SharedPayload> payloads) {
+	std::vector<std::pair<EventId, SharedEventObject>> events;
+	events.reserve (payloads.size ());
+
+	for (auto &payload : payloads) {
+		if (!payload)
+			throw exceptions::EventManagerException ("Empty payload for event " + std::to_string (event));
+		events.emplace_back (event, std::make_shared<const JsonEventObject> (payload));
+	}
+
+	dispatchEvents (events);
+}
+
+
+
+
+void EventManager::triggerEvents (EventId event, std::vector<Json::Value> &payloads) {
+	std::vector<SharedPayload> frozen;
+	frozen.reserve (payloads.size ());
+
+	for (auto &payload : payloads)
+		frozen.push_back (std::make_shared<const Json::Value> (payload));
+
+	triggerEvents (event, frozen);
+}
+
+
+
+
+void EventManager::triggerEvents (std::vector<std::pair<EventId, SharedPayload>> events) {
+	std::vector<std::pair<EventId, SharedEventObject>> objects;
+	objects.reserve (events.size ());
+
+	for (auto &event : events) {
+		if (!event.second)
+			throw exceptions::EventManagerException ("Empty payload for event " + std::to_string (event.first));
+		objects.emplace_back (event.first, std::make_shared<const JsonEventObject> (event.second));
+	}
+
+	dispatchEvents (objects);
+}
+
+
+
+
+SubscriptionId EventManager::onEventPattern (std::string pattern, SharedEventHandler handler, SubscriptionOptions options) {
+	if (!handler)
+		throw exceptions::EventManagerException ("Empty handler for pattern \"" + pattern + "\"");
+
+	return onEventPattern (pattern, PatternEventHandler ([handler] (EventId, SharedPayload payload) {
+		handler (payload);
+	}), options);
+}
+
+
+
+
+SubscriptionId EventManager::onEventPattern (std::string pattern, PatternEventHandler handler, SubscriptionOptions options) {
+	if (!handler)
+		throw exceptions::EventManagerException ("Empty handler for pattern \"" + pattern + "\"");
+
+	std::shared_ptr<Subscription> subscription	= std::make_shared<Subscription> ();
+	subscription->options						= options;
+	subscription->handler						= [handler] (EventId event, const SharedEventObject &object) {
+		handler (event, SharedPayload (object, &object->asJson ()));
+	};
+
+	return subscribePattern (pattern, subscription);
+}
+
+
+
+
+std::string EventManager::getEventTopic (EventId event) {
+	auto table	= eventTable.read ();
+
+	return topicOf (getEntry (*table, event));
+}
+
+
+
+
+void EventManager::openJournal (std::string directory, JournalOptions options) {
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	if (eventTable.get ()->journal)
+		throw exceptions::EventManagerException ("Event journal already open");
+
+	std::unique_ptr<EventTable> newTable (new EventTable (*eventTable.get ()));
+	newTable->journal	= std::make_shared<utils::EventJournal> (directory, options);
+
+	eventTable.publish (newTable.release ());
+}
+
+
+
+
+uint64_t EventManager::replayEvents (uint64_t fromOffset, ReplayHandler handler) {
+	if (!handler)
+		throw exceptions::EventManagerException ("Empty handler for journal replay");
+
+	std::shared_ptr<utils::EventJournal> journal	= eventTable.read ()->journal;
+	if (!journal)
+		throw exceptions::EventManagerException ("Event journal is not open");
+
+	// Identifiers depend on the order of registrations, so records store names which are resolved once per event
+	std::map<std::pair<std::string, std::string>, EventId> ids;
+	Json::CharReaderBuilder readerBuilder;
+	std::unique_ptr<Json::CharReader> reader (readerBuilder.newCharReader ());
+
+	return journal->replay (fromOffset, [&] (uint64_t offset, const std::string &service, const std::string &eventName,
+											  const std::string &payload) {
+		auto idIt	= ids.find (std::make_pair (service, eventName));
+		if (idIt == ids.end ()) {
+			std::unique_lock<std::mutex> lock (tableMutex);
+			idIt	= ids.emplace (std::make_pair (service, eventName), internEvent (service, eventName)).first;
+		}
+
+		std::shared_ptr<Json::Value> value	= std::make_shared<Json::Value> ();
+		std::string errors;
+		if (!reader->parse (payload.data (), payload.data () + payload.size (), value.get (), &errors))
+			throw exceptions::EventManagerException ("Corrupted payload at journal offset " + std::to_string (offset) + ": " + errors);
+
+		handler (offset, idIt->second, value);
+	});
+}
+
+
+
+
+SubscriptionId EventManager::onRequest (EventId endpoint, RequestHandler handler, SubscriptionOptions options) {
+	if (!handler)
+		throw exceptions::EventManagerException ("Empty handler for endpoint " + std::to_string (endpoint));
+
+	std::shared_ptr<Subscription> subscription	= std::make_shared<Subscription> ();
+	subscription->options						= options;
+
+	// Only requests reach a responder. Their reply is set here, on the dispatcher, without any other dispatch
+	subscription->handler	= [handler] (EventId, const SharedEventObject &object) {
+		const RequestObject &request	= static_cast<const RequestObject &> (*object);
+
+		// The deadline already failed it
+		if (request.isExpired ())
+			return;
+
+		try {
+			request.answer (handler (request.asJson ()));
+		} catch (...) {
+			request.fail (std::current_exception ());
+		}
+	};
+
+	return subscribeResponder (endpoint, subscription);
+}
+
+
+
+
+SubscriptionId EventManager::subscribeResponder (EventId endpoint, std::shared_ptr<Subscription> subscription) {
+	prepareSubscription (*subscription);
+
+	std::unique_lock<std::mutex> lock (tableMutex);
+
+	subscription->id	= nextSubscriptionId++;
+
+	if (holdSubscription (subscription, endpoint, true) || joinReplicas (subscription, endpoint, true))
+		return subscription->id;
+
+	updateEntry (endpoint, [&] (EventEntry &entry) {
+		if (entry.responder)
+			throw exceptions::EventManagerException ("Endpoint \"" + topicOf (entry) + "\" already has a responder");
+		entry.responder	= subscription;
+	});
+	subscription->events.push_back (endpoint);
+
+	indexSubscription (subscription);
+
+	return subscription->id;
+}
+
+
+
+
+SubscriptionId EventManager::onRequest (std::string service, std::string endpointName, RequestHandler handler,
+										SubscriptionOptions options) {
+	return onRequest (getEventId (service, endpointName), handler, options);
+}
+
+
+
+
+std::future<Json::Value> EventManager::request (EventId endpoint, SharedPayload payload, unsigned timeout) {
+	if (!payload)
+		throw exceptions::EventManagerException ("Empty payload for endpoint " + std::to_string (endpoint));
+
+	std::shared_ptr<RequestObject> request	= std::make_shared<RequestObject> (payload);
+	std::future<Json::Value> reply			= request->getReply ();
+	std::vector<DeferredPayloads> deferred;
+	{
+		auto table				= eventTable.read ();
+		const EventEntry &entry	= getEntry (*table, endpoint);
+
+		if (!entry.responder)
+			throw exceptions::EventManagerException ("Endpoint \"" + topicOf (entry) + "\" has no responder");
+
+		// The timer does not keep the request alive, so an answered request is released at once
+		if (timeout > 0) {
+			request->deadline		= utils::TimerQueue::Clock::now () + std::chrono::milliseconds (timeout);
+			request->hasDeadline	= true;
+
+			std::weak_ptr<RequestObject> pending	= request;
+			std::string topic						= topicOf (entry);
+			timers.schedule (request->deadline, [pending, topic] {
+				if (auto expired = pending.lock ())
+					expired->fail (std::make_exception_ptr (exceptions::RequestTimeoutException ("Request to \"" + topic + "\" timed out")));
+			});
+		}
+
+		SharedEventObject object	= request;
+		enqueue (entry.responder, endpoint, entry.options, &object, nullptr, 1, &deferred);
+	}
+
+	enqueueDeferred (deferred);
+
+	return reply;
+}
+
+
+
+
+std::future<Json::Value> EventManager::request (EventId endpoint, Json::Value payload, unsigned timeout) {
+	return request (endpoint, std::make_shared<const Json::Value> (std::move (payload)), timeout);
+}
+
+
+
+
+std::future<Json::Value> EventManager::request (std::string service, std::string endpointName, Json::Value payload,
+												unsigned timeout) {
+	return request (getEventId (service, endpointName), std::move (payload), timeout);
+}
+
+
+
+
+SubscriptionId EventManager::aggregateEvent (EventId event, std::string field, WindowOptions window, EventId output,
+											 SubscriptionOptions options) {
+	unsigned slide	= window.slide != 0 ? window.slide : window.size;
+	if (window.size == 0 || slide > window.size || window.size % slide != 0)
+		throw exceptions::EventManagerException ("Window size must be a non zero multiple of its slide");
+
+	// Aggregations accumulate inline, and a cached payload would be counted in a window it was not triggered in
+	if (options.lastValue)
+		throw exceptions::EventManagerException ("Aggregations cannot receive the last value of events");
+
+	{
+		auto table	= eventTable.read ();
+		getEntry (*table, output);
+	}
+
+	std::shared_ptr<WindowAggregator> aggregator	= std::make_shared<WindowAggregator> ();
+	aggregator->panes.assign (window.size / slide, WindowAggregator::Pane {0, 0, 0, 0});
+	aggregator->current		= 0;
+	aggregator->accumulated	= 1;
+	aggregator->field	= field.empty () ? std::vector<std::string> () : EventFilter::splitPath (field);
+	aggregator->output	= output;
+	aggregator->size	= window.size;
+	aggregator->slide	= slide;
+
+	// Accumulating is cheaper than a hop to a dispatcher, so it is never moved there
+	options.inlineDispatch	= true;
+	options.inlineBudget	= std::numeric_limits<unsigned>::max ();
+
+	std::shared_ptr<Subscription> subscription	= std::make_shared<Subscription> ();
+	subscription->options						= options;
+	subscription->handler						= [aggregator] (EventId, const SharedEventObject &object) {
+		const Json::Value *value	= EventFilter::resolve (object->asJson (), aggregator->field);
+
+		// Payloads without a numeric field are not counted
+		if (!value || !value->isNumeric ())
+			return;
+
+		double number	= value->asDouble ();
+
+		std::unique_lock<std::mutex> lock (aggregator->mutex);
+		WindowAggregator::Pane &pane	= aggregator->panes[aggregator->current];
+		pane.min	= pane.count == 0 ? number : std::min (pane.min, number);
+		pane.max	= pane.count == 0 ? number : std::max (pane.max, number);
+		pane.sum	+= number;
+		pane.count++;
+	};
+
+	SubscriptionId id	= subscribe (event, subscription);
+
+	closeWindow (subscription, aggregator, utils::TimerQueue::Clock::now () + std::chrono::milliseconds (slide));
+
+	return id;
+}
+
+
+
+
+void EventManager::closeWindow (std::weak_ptr<Subscription> subscription, std::shared_ptr<WindowAggregator> aggregator,
+								utils::TimerQueue::Clock::time_point deadline) {
+	// The first call only schedules the end of the first window
+	if (deadline > utils::TimerQueue::Clock::now ()) {
+		timers.schedule (deadline, [this, subscription, aggregator, deadline] {
+			closeWindow (subscription, aggregator, deadline);
+		});
+		return;
+	}
+
+	std::shared_ptr<Subscription> alive	= subscription.lock ();
+	if (!alive || alive->cancelled)
+		return;
+
+	WindowAggregator::Pane window {0, 0, 0, 0};
+	size_t accumulated;
+	{
+		std::unique_lock<std::mutex> lock (aggregator->mutex);
+
+		for (auto &pane : aggregator->panes) {
+			if (pane.count == 0)
+				continue;
+			window.min	= window.count == 0 ? pane.min : std::min (window.min, pane.min);
+			window.max	= window.count == 0 ? pane.max : std::max (window.max, pane.max);
+			window.sum	+= pane.sum;
+			window.count	+= pane.count;
+		}
+
+		// The oldest pane leaves the window and receives the next payloads
+		aggregator->current						= (aggregator->current + 1) % aggregator->panes.size ();
+		aggregator->panes[aggregator->current]	= WindowAggregator::Pane {0, 0, 0, 0};
+		accumulated								= aggregator->accumulated;
+		aggregator->accumulated					= std::min (accumulated + 1, aggregator->panes.size ());
+	}
+
+	// Next deadline is computed from this one, so windows do not drift
+	utils::TimerQueue::Clock::time_point next	= deadline + std::chrono::milliseconds (aggregator->slide);
+	timers.schedule (next, [this, subscription, aggregator, next] {
+		closeWindow (subscription, aggregator, next);
+	});
+
+	if (window.count == 0)
+		return;
+
+	long long end	= std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::system_clock::now ().time_since_epoch ()).count ();
+
+	Json::Value result;
+	result["count"]	= Json::UInt64 (window.count);
+	result["sum"]	= window.sum;
+	result["min"]	= window.min;
+	result["max"]	= window.max;
+	result["mean"]	= window.sum / window.count;
+	// Until the first windows are full, they start with the aggregation
+	result["start"]	= Json::Int64 (end - static_cast<long long> (accumulated * aggregator->slide));
+	result["end"]	= Json::Int64 (end);
+
+	// An output whose service left is not triggered, but the aggregation goes on
+	insideTimer	= true;
+	try {
+		dispatchEvent (aggregator->output, std::make_shared<const JsonEventObject> (std::make_shared<const Json::Value> (std::move (result))));
+	} catch (exceptions::EventManagerException &) {
+	}
+	insideTimer	= false;
+}
@@ -0,0 +1,864 @@
+/**
+ * \file serviceRegistry.cpp
+ * \author Luca Di Mauro
+ * \brief Implementation of class ServiceRegistry
+ */
+
+
+#include <core/microservicespp.hpp>
+
+#include <algorithm>
+
+using namespace microservicespp;
+
+
+typedef std::chrono::steady_clock Clock;
+
+// Starting services mostly waits for disk and network, so more services than cores are started at once
+static const unsigned startupWorkersPerCore	= 4;
+
+// Delay before starting again a lazy service whose activation failed. Its events wait meanwhile
+static const std::chrono::seconds activationRetryDelay (1);
+
+
+namespace {
+
+	std::chrono::microseconds elapsed (Clock::time_point since) {
+		return std::chrono::duration_cast<std::chrono::microseconds> (Clock::now () - since);
+	}
+}
+
+
+
+
+ServiceRegistry::ServiceRegistry (Engine &engine) : engine (engine), started (false),
+													 directory (new utils::FrozenStringMap<std::shared_ptr<Service>> ()),
+													 activations (std::make_shared<ActivationQueue> ()) {}
+
+
+
+
+// Hooks are implemented by derived classes, already destroyed here: services still running are only stopped
+ServiceRegistry::~ServiceRegistry () {
+	stopActivator ();
+
+	for (auto &entry : takeServices ())
+		stopInstances (*entry);
+}
+
+
+
+
+void ServiceRegistry::startRegistry () {
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		started	= true;
+
+		// Lazy services which were active when the registry stopped left with their subscriptions: their events are
+		// waited for again
+		for (auto &lazy : lazyServices) {
+			if (!lazy.second->armed) {
+				lazyArm (lazy.first, lazy.second->activation, activationOf (lazy.first));
+				lazy.second->armed	= true;
+			}
+		}
+	}
+
+	{
+		std::unique_lock<std::mutex> lock (activations->mutex);
+		activations->stop	= false;
+	}
+	if (!activator.joinable ())
+		activator	= std::thread (&ServiceRegistry::activatorLoop, this);
+
+	// Timings of started services are kept for "getStartupReport"
+	startServices ();
+}
+
+
+
+
+void ServiceRegistry::stopRegistry () {
+	stopActivator ();
+
+	for (auto &entry : takeServices ())
+		shutdownService (*entry);
+}
+
+
+
+
+void ServiceRegistry::closeRetiredModules () {
+	std::vector<RetiredModule> released;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+
+		auto expired	= [] (const std::weak_ptr<const void> &subscription) { return subscription.expired (); };
+		for (auto it=retiredModules.begin (); it!=retiredModules.end (); ) {
+			if (std::all_of (it->subscriptions.begin (), it->subscriptions.end (), expired)) {
+				released.push_back (std::move (*it));
+				it	= retiredModules.erase (it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	// Modules are closed here, out of the lock
+}
+
+
+
+
+void ServiceRegistry::stopActivator () {
+	// Lazy services are neither started nor stopped from now on
+	{
+		std::unique_lock<std::mutex> lock (activations->mutex);
+		activations->stop	= true;
+	}
+	activations->condition.notify_all ();
+	if (activator.joinable ())
+		activator.join ();
+}
+
+
+
+
+std::vector<std::shared_ptr<ServiceRegistry::ServiceEntry>> ServiceRegistry::takeServices () {
+	std::vector<std::shared_ptr<ServiceEntry>> running;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		started	= false;
+
+		for (auto &lazy : lazyServices) {
+			lazy.second->active	= false;
+			lazy.second->timed	= false;
+		}
+
+		for (auto &entry : services)
+			running.push_back (entry.second);
+		services.clear ();
+		publishDirectory ();
+	}
+
+	// Services are stopped in the opposite order of run levels, so each one stops before those it may depend on
+	std::stable_sort (running.begin (), running.end (), [] (const std::shared_ptr<ServiceEntry> &a, const std::shared_ptr<ServiceEntry> &b) {
+		return a->runLevel > b->runLevel;
+	});
+
+	return running;
+}
+
+
+
+
+bool ServiceRegistry::isStarted () {
+	std::unique_lock<std::mutex> lock (servicesMutex);
+
+	return started;
+}
+
+
+
+
+void ServiceRegistry::checkUnique (const std::string &name) {
+	bool declared	= std::any_of (declaredServices.begin (), declaredServices.end (), [&name] (const std::shared_ptr<ServiceEntry> &entry) {
+		return entry->name == name;
+	});
+
+	if (declared || services.find (name) != services.end () || lazyServices.find (name) != lazyServices.end ())
+		throw exceptions::ServiceRegistryException ("Service \"" + name + "\" already exists");
+}
+
+
+
+
+void ServiceRegistry::shutdownService (ServiceEntry &entry) {
+	bool replicated	= !entry.replicas.empty ();
+
+	stopInstances (entry);
+
+	if (replicated)
+		replicateService (entry.name, ReplicaOptions ());
+}
+
+
+
+
+void ServiceRegistry::stopInstances (ServiceEntry &entry) {
+	for (auto it=entry.replicas.rbegin (); it!=entry.replicas.rend (); ++it)
+		(*it)->stopMe ();
+	if (entry.service)
+		entry.service->stopMe ();
+
+	entry.replicas.clear ();
+	entry.service.reset ();
+}
+
+
+
+
+void ServiceRegistry::publishDirectory () {
+	std::vector<std::pair<std::string, std::shared_ptr<Service>>> entries;
+	entries.reserve (services.size ());
+	for (auto &entry : services)
+		entries.emplace_back (entry.first, entry.second->service);
+
+	directory.publish (new utils::FrozenStringMap<std::shared_ptr<Service>> (entries));
+}
+
+
+
+
+void ServiceRegistry::bootService (ServiceEntry &entry, ServiceStartup &startup) {
+	startup.name		= entry.name;
+	startup.runLevel	= entry.runLevel;
+
+	Clock::time_point begin	= Clock::now ();
+	entry.loader.reset (new dynamicLoader::DynamicLoader<Service> (entry.soPath));
+	startup.loading			= elapsed (begin);
+
+	begin	= Clock::now ();
+	Service *service	= entry.loader->makeObject (&engine, entry.name, entry.runLevel);
+	if (!service)
+		throw exceptions::ServiceRegistryException ("Module \"" + entry.soPath + "\" did not create service \"" + entry.name + "\"");
+	startup.construction	= elapsed (begin);
+
+	// The destructor of the instance is code of the module, which handles returned by "getService" keep loaded
+	std::shared_ptr<dynamicLoader::DynamicLoader<Service>> loader	= entry.loader;
+	entry.service.reset (service, [loader] (Service *instance) { delete instance; });
+
+	begin	= Clock::now ();
+	entry.service->startMe ();
+	startup.starting		= elapsed (begin);
+}
+
+
+
+
+void ServiceRegistry::loadService (std::string soPath, std::string name, int runLevel) {
+	std::shared_ptr<ServiceEntry> entry	= std::make_shared<ServiceEntry> ();
+	entry->soPath						= soPath;
+	entry->name							= name;
+	entry->runLevel						= runLevel;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		checkUnique (name);
+	}
+
+	ServiceStartup startup;
+	bootService (*entry, startup);
+
+	std::unique_lock<std::mutex> lock (servicesMutex);
+	checkUnique (name);
+	services[name]	= entry;
+	publishDirectory ();
+}
+
+
+
+
+void ServiceRegistry::loadReplicatedService (std::string soPath, std::string name, int runLevel, ReplicaOptions options) {
+	if (options.replicas == 0)
+		throw exceptions::ServiceRegistryException ("Service \"" + name + "\" needs at least one replica");
+
+	std::shared_ptr<ServiceEntry> entry	= std::make_shared<ServiceEntry> ();
+	entry->soPath						= soPath;
+	entry->name							= name;
+	entry->runLevel						= runLevel;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		checkUnique (name);
+	}
+
+	// Instances find the service replicated when they join, and all of them come from the same module
+	replicateService (name, options);
+	bool booted	= false;
+	try {
+		ServiceStartup startup;
+		replicaBegin (name, 0);
+		bootService (*entry, startup);
+		booted	= true;
+
+		for (unsigned i=1; i<options.replicas; i++) {
+			replicaBegin (name, i);
+			std::unique_ptr<Service> replica (entry->loader->makeObject (&engine, name, runLevel));
+			if (!replica)
+				throw exceptions::ServiceRegistryException ("Module \"" + soPath + "\" did not create service \"" + name + "\"");
+
+			replica->startMe ();
+			entry->replicas.push_back (std::move (replica));
+		}
+
+		// Subscriptions shared by the instances deliver only from now on
+		replicaEnd (name);
+	} catch (...) {
+		if (booted)
+			shutdownService (*entry);
+		entry->service.reset ();
+		replicateService (name, ReplicaOptions ());
+		throw;
+	}
+
+	std::unique_lock<std::mutex> lock (servicesMutex);
+	checkUnique (name);
+	services[name]	= entry;
+	publishDirectory ();
+}
+
+
+
+
+void ServiceRegistry::declareService (std::string soPath, std::string name, int runLevel, std::vector<std::string> dependencies) {
+	std::shared_ptr<ServiceEntry> entry	= std::make_shared<ServiceEntry> ();
+	entry->soPath						= soPath;
+	entry->name							= name;
+	entry->runLevel						= runLevel;
+	entry->dependencies					= dependencies;
+
+	std::unique_lock<std::mutex> lock (servicesMutex);
+	checkUnique (name);
+	declaredServices.push_back (entry);
+}
+
+
+
+
+std::vector<ServiceStartup> ServiceRegistry::startServices () {
+	std::vector<std::shared_ptr<ServiceEntry>> plan;
+	std::map<std::string, size_t> indexes;
+
+	// Each service waits for the services it depends on, either by run level or by declaration
+	std::vector<std::vector<size_t>> dependents;
+	std::vector<size_t> waiting;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+
+		for (size_t i=0; i<declaredServices.size (); i++)
+			indexes[declaredServices[i]->name]	= i;
+
+		dependents.resize (declaredServices.size ());
+		waiting.resize (declaredServices.size (), 0);
+		auto addDependency	= [&] (size_t dependency, size_t dependent) {
+			dependents[dependency].push_back (dependent);
+			waiting[dependent]++;
+		};
+
+		// A run level waits only for the nearest lower one, which in turn waited for the levels below it
+		std::map<int, std::vector<size_t>> runLevels;
+		for (size_t i=0; i<declaredServices.size (); i++)
+			runLevels[declaredServices[i]->runLevel].push_back (i);
+
+		const std::vector<size_t> *lowerLevel	= nullptr;
+		for (auto &level : runLevels) {
+			if (lowerLevel) {
+				for (size_t dependent : level.second) {
+					for (size_t dependency : *lowerLevel)
+						addDependency (dependency, dependent);
+				}
+			}
+			lowerLevel	= &level.second;
+		}
+
+		// Rejected services are discarded, so they can be declared again, while the others stay declared
+		auto reject	= [&] (const std::vector<bool> &rejected, const std::string &error) {
+			std::vector<std::shared_ptr<ServiceEntry>> kept;
+			for (size_t i=0; i<declaredServices.size (); i++) {
+				if (!rejected[i])
+					kept.push_back (declaredServices[i]);
+			}
+			declaredServices.swap (kept);
+			startupReport.clear ();
+			throw exceptions::ServiceRegistryException (error);
+		};
+
+		// A service depending on an unknown service is rejected, and so are the services depending on it
+		std::vector<bool> rejected (declaredServices.size (), false);
+		std::string error;
+		for (bool changed=true; changed; ) {
+			changed	= false;
+			for (size_t i=0; i<declaredServices.size (); i++) {
+				for (auto &name : declaredServices[i]->dependencies) {
+					auto it		= indexes.find (name);
+					bool known	= (it != indexes.end ()) ? !rejected[it->second] : services.find (name) != services.end ();
+					if (!rejected[i] && !known) {
+						rejected[i]	= true;
+						changed		= true;
+						if (error.empty ())
+							error	= "Service \"" + declaredServices[i]->name + "\" depends on unknown service \"" + name + "\"";
+					}
+				}
+			}
+		}
+		if (!error.empty ())
+			reject (rejected, error);
+
+		for (size_t i=0; i<declaredServices.size (); i++) {
+			for (auto &name : declaredServices[i]->dependencies) {
+				auto it	= indexes.find (name);
+				if (it != indexes.end ())
+					addDependency (it->second, i);
+			}
+		}
+
+		// Services never reached by a topological visit are on a cycle
+		std::vector<size_t> pending	= waiting;
+		std::vector<size_t> visit;
+		for (size_t i=0; i<pending.size (); i++) {
+			if (pending[i] == 0)
+				visit.push_back (i);
+		}
+		for (size_t next=0; next<visit.size (); next++) {
+			for (size_t dependent : dependents[visit[next]]) {
+				if (--pending[dependent] == 0)
+					visit.push_back (dependent);
+			}
+		}
+		if (visit.size () != declaredServices.size ()) {
+			std::string cycle;
+			for (size_t i=0; i<pending.size (); i++) {
+				rejected[i]	= pending[i] != 0;
+				if (rejected[i])
+					cycle	+= (cycle.empty () ? "\"" : ", \"") + declaredServices[i]->name + "\"";
+			}
+			reject (rejected, "Dependencies of services " + cycle + " contain a cycle");
+		}
+
+		plan.swap (declaredServices);
+	}
+
+	std::deque<size_t> ready;
+	for (size_t i=0; i<plan.size (); i++) {
+		if (waiting[i] == 0)
+			ready.push_back (i);
+	}
+
+	std::vector<ServiceStartup> report;
+	std::vector<bool> started (plan.size (), false);
+	std::mutex mutex;
+	std::condition_variable condition;
+	size_t booting	= 0;
+	std::string failure;
+	Clock::time_point begin	= Clock::now ();
+
+	// Workers take services whose dependencies are all started. After a failure, services not depending on the failed
+	// one are still taken
+	auto worker	= [&] {
+		std::unique_lock<std::mutex> lock (mutex);
+
+		while (true) {
+			condition.wait (lock, [&] { return !ready.empty () || booting == 0; });
+			if (ready.empty ())
+				return;
+
+			size_t index	= ready.front ();
+			ready.pop_front ();
+			booting++;
+			lock.unlock ();
+
+			ServiceEntry &entry	= *plan[index];
+			ServiceStartup startup;
+			std::string error;
+			try {
+				bootService (entry, startup);
+				startup.ready	= elapsed (begin);
+
+				// Services starting later can find it while they start
+				std::unique_lock<std::mutex> servicesLock (servicesMutex);
+				services[entry.name]	= plan[index];
+				publishDirectory ();
+			} catch (std::exception &e) {
+				error	= "Cannot start service \"" + entry.name + "\": " + e.what ();
+			} catch (...) {
+				error	= "Cannot start service \"" + entry.name + "\"";
+			}
+
+			if (!error.empty ()) {
+				entry.service.reset ();
+				entry.loader.reset ();
+			}
+
+			lock.lock ();
+			booting--;
+
+			if (error.empty ()) {
+				report.push_back (startup);
+				started[index]	= true;
+				for (size_t dependent : dependents[index]) {
+					if (--waiting[dependent] == 0)
+						ready.push_back (dependent);
+				}
+			}
+			else if (failure.empty ()) {
+				failure	= error;
+			}
+
+			condition.notify_all ();
+		}
+	};
+
+	unsigned cores			= std::max (1u, std::thread::hardware_concurrency ());
+	unsigned workersNumber	= std::max (1u, std::min<unsigned> (cores * startupWorkersPerCore, plan.size ()));
+	std::vector<std::thread> workers;
+	for (unsigned i=0; i<workersNumber; i++)
+		workers.emplace_back (worker);
+	for (auto &t : workers)
+		t.join ();
+
+	// Services not started, because they failed or depend on a failed service, are declared again in their order
+	std::vector<std::shared_ptr<ServiceEntry>> notStarted;
+	for (size_t i=0; i<plan.size (); i++) {
+		if (!started[i])
+			notStarted.push_back (plan[i]);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		startupReport	= report;
+		declaredServices.insert (declaredServices.begin (), notStarted.begin (), notStarted.end ());
+	}
+
+	if (!failure.empty ())
+		throw exceptions::ServiceRegistryException (failure);
+
+	return report;
+}
+
+
+
+
+std::vector<ServiceStartup> ServiceRegistry::getStartupReport () {
+	std::unique_lock<std::mutex> lock (servicesMutex);
+	return startupReport;
+}
+
+
+
+
+bool ServiceRegistry::existsService (const std::string &name) {
+	return directory.read ()->find (name) != nullptr;
+}
+
+
+
+
+void ServiceRegistry::unloadService (std::string name) {
+	std::shared_ptr<ServiceEntry> entry;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+
+		auto it	= services.find (name);
+		if (it == services.end ())
+			throw exceptions::ServiceRegistryException ("Service \"" + name + "\" does not exist");
+
+		entry	= it->second;
+		services.erase (it);
+		publishDirectory ();
+
+		// An unloaded lazy service is never activated again
+		lazyServices.erase (name);
+	}
+
+	shutdownService (*entry);
+	closeRetiredModules ();
+}
+
+
+
+
+std::shared_ptr<Service> ServiceRegistry::getService (const std::string &name) {
+	auto snapshot	= directory.read ();
+	const std::shared_ptr<Service> *service	= snapshot->find (name);
+	if (!service)
+		throw exceptions::ServiceRegistryException ("Service \"" + name + "\" does not exist");
+
+	return *service;
+}
+
+
+
+
+std::shared_ptr<Service> ServiceRegistry::getService (const char *name) {
+	auto snapshot	= directory.read ();
+	const std::shared_ptr<Service> *service	= snapshot->find (name);
+	if (!service)
+		throw exceptions::ServiceRegistryException ("Service \"" + std::string (name) + "\" does not exist");
+
+	return *service;
+}
+
+
+
+
+void ServiceRegistry::reloadService (std::string name, std::string soPath, StateTransferFunction transfer) {
+	std::shared_ptr<ServiceEntry> previous;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+
+		auto it	= services.find (name);
+		if (it == services.end ())
+			throw exceptions::ServiceRegistryException ("Service \"" + name + "\" does not exist");
+
+		previous	= it->second;
+	}
+
+	if (!previous->replicas.empty ())
+		throw exceptions::ServiceRegistryException ("Replicated service \"" + name + "\" cannot be reloaded");
+
+	// The registry stops and starts a lazy service through its own entry, which a reload would leave stale
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		if (lazyServices.find (name) != lazyServices.end ())
+			throw exceptions::ServiceRegistryException ("Lazy service \"" + name + "\" cannot be reloaded");
+	}
+
+	// Opening the same path again would return the module already loaded, with the old code
+	if (soPath == previous->soPath)
+		throw exceptions::ServiceRegistryException ("Service \"" + name + "\" must be reloaded from a module other than \"" + soPath + "\"");
+
+	std::shared_ptr<ServiceEntry> entry	= std::make_shared<ServiceEntry> ();
+	entry->soPath						= soPath;
+	entry->name							= name;
+	entry->runLevel						= previous->runLevel;
+	entry->dependencies					= previous->dependencies;
+
+	// Only the transfer of the state delays events of the service: the new instance starts while the old one runs
+	reloadBegin (name);
+	bool booted	= false;
+	std::vector<std::weak_ptr<const void>> replaced;
+	try {
+		ServiceStartup startup;
+		bootService (*entry, startup);
+		booted	= true;
+
+		reloadPause (name);
+		if (transfer)
+			transfer (*previous->service, *entry->service);
+
+		// If the swap fails, nothing changed and the reload is aborted as well
+		replaced	= reloadEnd (name, true);
+	} catch (...) {
+		reloadEnd (name, false);
+		if (booted)
+			entry->service->stopMe ();
+		entry->service.reset ();
+		throw;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		services[name]	= entry;
+		publishDirectory ();
+		retiredModules.push_back (RetiredModule {std::move (previous->loader), replaced});
+	}
+
+	previous->service->stopMe ();
+	previous->service.reset ();
+
+	// Modules of previous reloads may be released by now, this one too if no handler of the old instance was running
+	closeRetiredModules ();
+}
+
+
+
+
+void ServiceRegistry::declareLazyService (std::string soPath, std::string name, int runLevel, LazyActivation activation) {
+	std::shared_ptr<LazyService> lazy	= std::make_shared<LazyService> ();
+	lazy->entry							= std::make_shared<ServiceEntry> ();
+	lazy->entry->soPath					= soPath;
+	lazy->entry->name					= name;
+	lazy->entry->runLevel				= runLevel;
+	lazy->activation					= activation;
+	lazy->active						= false;
+	lazy->armed							= false;
+	lazy->activity						= 0;
+	lazy->timed							= false;
+
+	std::unique_lock<std::mutex> lock (servicesMutex);
+	checkUnique (name);
+
+	lazyArm (name, activation, activationOf (name));
+	lazy->armed			= true;
+	lazyServices[name]	= lazy;
+}
+
+
+
+
+std::function<void ()> ServiceRegistry::activationOf (const std::string &name) {
+	std::weak_ptr<ActivationQueue> queue	= activations;
+
+	// Called on the timer thread of events, so it only queues the request
+	return [queue, name] {
+		std::shared_ptr<ActivationQueue> activations	= queue.lock ();
+		if (!activations)
+			return;
+
+		{
+			std::unique_lock<std::mutex> lock (activations->mutex);
+			activations->requests.push_back (name);
+		}
+		activations->condition.notify_one ();
+	};
+}
+
+
+
+
+void ServiceRegistry::activatorLoop () {
+	ActivationQueue &queue	= *activations;
+
+	while (true) {
+		// Deadlines are set only by this thread, so none can be missed while waiting
+		std::string name;
+		bool timed	= false;
+		Clock::time_point deadline;
+		{
+			std::unique_lock<std::mutex> lock (servicesMutex);
+			for (auto &lazy : lazyServices) {
+				if (lazy.second->timed && (!timed || lazy.second->deadline < deadline)) {
+					timed		= true;
+					deadline	= lazy.second->deadline;
+					name		= lazy.first;
+				}
+			}
+		}
+
+		bool requested	= false;
+		{
+			std::unique_lock<std::mutex> lock (queue.mutex);
+			auto ready	= [&] { return queue.stop || !queue.requests.empty (); };
+			if (timed)
+				queue.condition.wait_until (lock, deadline, ready);
+			else
+				queue.condition.wait (lock, ready);
+
+			if (queue.stop)
+				return;
+
+			if (!queue.requests.empty ()) {
+				name		= queue.requests.front ();
+				requested	= true;
+				queue.requests.pop_front ();
+			}
+			else if (Clock::now () < deadline) {
+				continue;
+			}
+		}
+
+		bool active	= false;
+		{
+			std::unique_lock<std::mutex> lock (servicesMutex);
+			auto it	= lazyServices.find (name);
+			if (it == lazyServices.end ())
+				continue;
+			active	= it->second->active;
+		}
+
+		if (!active)
+			activateService (name);
+		else if (!requested)
+			checkIdleService (name);
+	}
+}
+
+
+
+
+void ServiceRegistry::activateService (const std::string &name) {
+	std::shared_ptr<LazyService> lazy;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		auto it	= lazyServices.find (name);
+		if (it == lazyServices.end ())
+			return;
+
+		lazy		= it->second;
+		lazy->timed	= false;
+	}
+
+	// Placeholders are already paused, so the service has only to replace them
+	reloadBegin (name);
+	bool booted	= false;
+	try {
+		ServiceStartup startup;
+		bootService (*lazy->entry, startup);
+		booted	= true;
+
+		reloadEnd (name, true);
+	} catch (...) {
+		reloadEnd (name, false);
+		if (booted)
+			lazy->entry->service->stopMe ();
+		lazy->entry->service.reset ();
+
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		lazy->timed		= true;
+		lazy->deadline	= Clock::now () + activationRetryDelay;
+		return;
+	}
+
+	uint64_t activity	= lazyActivity (name);
+
+	std::unique_lock<std::mutex> lock (servicesMutex);
+	services[name]	= lazy->entry;
+	publishDirectory ();
+
+	lazy->active	= true;
+	lazy->armed		= false;
+	lazy->activity	= activity;
+	lazy->timed		= lazy->activation.idleTimeout > 0;
+	lazy->deadline	= Clock::now () + std::chrono::milliseconds (lazy->activation.idleTimeout);
+}
+
+
+
+
+void ServiceRegistry::checkIdleService (const std::string &name) {
+	std::shared_ptr<LazyService> lazy;
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		auto it	= lazyServices.find (name);
+		if (it == lazyServices.end ())
+			return;
+
+		lazy	= it->second;
+	}
+
+	uint64_t activity	= lazyActivity (name);
+	if (activity != lazy->activity) {
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		lazy->activity	= activity;
+		lazy->deadline	= Clock::now () + std::chrono::milliseconds (lazy->activation.idleTimeout);
+		return;
+	}
+
+	// Placeholders replace the subscriptions of the service, taking the events it has not handled yet.
+	// If they cannot, the service stays active until the next check
+	reloadBegin (name);
+	try {
+		lazyArm (name, lazy->activation, activationOf (name));
+		reloadPause (name);
+		reloadEnd (name, true);
+	} catch (...) {
+		reloadEnd (name, false);
+
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		lazy->deadline	= Clock::now () + std::chrono::milliseconds (lazy->activation.idleTimeout);
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock (servicesMutex);
+		services.erase (name);
+		publishDirectory ();
+
+		lazy->active	= false;
+		lazy->armed		= true;
+		lazy->timed		= false;
+	}
+
+	lazy->entry->service->stopMe ();
+	lazy->entry->service.reset ();
+}
@@ -0,0 +1,73 @@
+/**
+ * \file engineDouble.cpp
+ * \author Luca Di Mauro
+ * \brief Implementation of the test doubles of Engine and Service
+ */
+
+#include <engineDouble.hpp>
+
+using namespace microservicespp;
+
+
+std::function<void (Service &)> doubles::serviceCreated;
+std::function<void (Service &)> doubles::serviceStarting;
+
+
+namespace microservicespp {
+
+	// Only declared by the library: services of the tests never use it
+	class Coordinator {};
+}
+
+
+namespace {
+
+	Json::Value emptyConfiguration;
+	Coordinator coordinatorDouble;
+}
+
+
+
+
+Engine::Engine (std::string configurationFile) : EventManager (*this), ServiceRegistry (*this),
+												 configuration (emptyConfiguration) {}
+
+
+
+
+Service::Service (std::string name, Engine &engine, int runLevel, PrepareShutdownFunction function) :
+	name (name), prepareShutdown (function), runLevel (runLevel), status (ServiceStatus::Loading), coordinator (coordinatorDouble) {
+	if (doubles::serviceCreated)
+		doubles::serviceCreated (*this);
+}
+
+
+Service::~Service () {}
+
+
+void Service::startMe () {
+	if (doubles::serviceStarting)
+		doubles::serviceStarting (*this);
+
+	std::unique_lock<std::mutex> lock (statusMutex);
+	status	= ServiceStatus::Running;
+}
+
+
+void Service::stopMe () {
+	prepareShutdown ();
+
+	std::unique_lock<std::mutex> lock (statusMutex);
+	status	= ServiceStatus::Died;
+}
+
+
+std::string Service::getName () {
+	return name;
+}
+
+
+ServiceStatus Service::getStatus () {
+	std::unique_lock<std::mutex> lock (statusMutex);
+	return status;
+}
@@ -0,0 +1,46 @@
+/**
+ * \file engineDouble.hpp
+ * \author Luca Di Mauro
+ * \brief Test doubles of the parts of Engine and Service not implemented yet, so tests can build a real Engine
+ */
+
+
+#ifndef ENGINE_DOUBLE_H
+#define ENGINE_DOUBLE_H
+
+#include <core/microservicespp.hpp>
+
+#include <functional>
+
+
+namespace microservicespp {
+	namespace doubles {
+
+		/**
+		 * \brief Called by the constructor of each Service, also when built by a test module: tests use it to make
+		 * subscriptions on behalf of the new instance
+		 */
+		extern std::function<void (Service &instance)> serviceCreated;
+
+		/**
+		 * \brief Called by "Service::startMe": a test makes a service fail its start throwing from it
+		 */
+		extern std::function<void (Service &instance)> serviceStarting;
+
+
+		/**
+		 * \class EngineHolder
+		 * \brief Owns an Engine built with no configuration. A test class derives from it before deriving from the
+		 * classes which need an Engine, so that the Engine is built first
+		 */
+		struct EngineHolder {
+			Engine engineDouble;
+
+			EngineHolder () : engineDouble ("") {}
+		};
+
+	} // namespace doubles
+} // namespace microservicespp
+
+
+#endif
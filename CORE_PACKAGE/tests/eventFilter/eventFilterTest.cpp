@@ -0,0 +1,119 @@
+#define CATCH_CONFIG_MAIN
+
+#include <thirdParty/catch.hpp>
+#include <core/eventFilter.hpp>
+
+using namespace std;
+using namespace microservicespp;
+
+
+static Json::Value parse (const string &text) {
+	Json::Value value;
+	Json::Reader reader;
+	REQUIRE (reader.parse (text, value));
+	return value;
+}
+
+
+TEST_CASE( "Combining filters with and, or and not" ) {
+	Json::Value payload	= parse ("{\"a\": 1, \"b\": 2, \"c\": 3}");
+
+	EventFilter a	= EventFilter::where ("a", FilterOperator::Equal, 1);
+	EventFilter b	= EventFilter::where ("b", FilterOperator::Equal, 0);
+	EventFilter c	= EventFilter::where ("c", FilterOperator::Greater, 2);
+	EventFilter d	= EventFilter::where ("d", FilterOperator::Exists);
+
+	REQUIRE (EventFilter ().matches (payload));
+	REQUIRE (EventFilter ().isEmpty ());
+	REQUIRE_FALSE (a.isEmpty ());
+
+	REQUIRE ((a && c).matches (payload));
+	REQUIRE_FALSE ((a && b).matches (payload));
+	REQUIRE ((b || c).matches (payload));
+	REQUIRE_FALSE ((b || d).matches (payload));
+	REQUIRE ((!b).matches (payload));
+	REQUIRE_FALSE ((!!b).matches (payload));
+
+	// Operands made of compound sub-expressions must be found by their span
+	REQUIRE (((a && !b) || (d && c)).matches (payload));
+	REQUIRE_FALSE (((a && b) || (d && c)).matches (payload));
+	REQUIRE ((!(a && b) && (c || d)).matches (payload));
+	REQUIRE_FALSE (((b || d) && (a || c)).matches (payload));
+	REQUIRE ((a && (b || (c && !d))).matches (payload));
+	REQUIRE_FALSE ((a && (b || !(c || d))).matches (payload));
+	REQUIRE ((((a || b) && (c || d)) && !(b && d)).matches (payload));
+
+	// An empty filter is neutral for "&&" and absorbing for "||"
+	REQUIRE_FALSE ((EventFilter () && b).matches (payload));
+	REQUIRE ((EventFilter () || b).matches (payload));
+	REQUIRE ((b || EventFilter ()).isEmpty ());
+
+	REQUIRE_THROWS (!EventFilter ());
+	REQUIRE_THROWS (EventFilter::where ("", FilterOperator::Exists));
+}
+
+
+TEST_CASE( "Resolving dotted and array index paths" ) {
+	Json::Value payload	= parse ("{\"position\": {\"x\": 4, \"y\": -1}, \"items\": [{\"id\": \"first\"}, {\"id\": \"second\"}],"
+								 " \"matrix\": [[1, 2], [3, 4]], \"10\": \"key\"}");
+
+	REQUIRE (EventFilter::where ("position.x", FilterOperator::Equal, 4).matches (payload));
+	REQUIRE (EventFilter::where ("position.y", FilterOperator::Less, 0).matches (payload));
+	REQUIRE (EventFilter::where ("items.1.id", FilterOperator::Equal, "second").matches (payload));
+	REQUIRE (EventFilter::where ("matrix.1.0", FilterOperator::Equal, 3).matches (payload));
+	REQUIRE (EventFilter::where ("10", FilterOperator::Equal, "key").matches (payload));
+
+	REQUIRE (EventFilter::where ("items.2", FilterOperator::Missing).matches (payload));
+	REQUIRE (EventFilter::where ("items.first", FilterOperator::Missing).matches (payload));
+	REQUIRE (EventFilter::where ("items.-1", FilterOperator::Missing).matches (payload));
+	REQUIRE (EventFilter::where ("position.x.z", FilterOperator::Missing).matches (payload));
+	REQUIRE (EventFilter::where ("position.", FilterOperator::Missing).matches (payload));
+	REQUIRE_FALSE (EventFilter::where ("items.2.id", FilterOperator::Equal, "second").matches (payload));
+	REQUIRE_FALSE (EventFilter::where ("items.2.id", FilterOperator::NotEqual, "second").matches (payload));
+}
+
+
+TEST_CASE( "Exists and Missing operators" ) {
+	Json::Value payload	= parse ("{\"present\": null, \"nested\": {\"flag\": false}}");
+
+	REQUIRE (EventFilter::where ("present", FilterOperator::Exists).matches (payload));
+	REQUIRE_FALSE (EventFilter::where ("present", FilterOperator::Missing).matches (payload));
+	REQUIRE (EventFilter::where ("nested.flag", FilterOperator::Exists).matches (payload));
+	REQUIRE (EventFilter::where ("nested.other", FilterOperator::Missing).matches (payload));
+	REQUIRE_FALSE (EventFilter::where ("nested.other", FilterOperator::Exists).matches (payload));
+	REQUIRE (EventFilter::where ("absent", FilterOperator::Missing).matches (Json::Value (3)));
+}
+
+
+TEST_CASE( "Comparing values of mixed types" ) {
+	Json::Value payload	= parse ("{\"int\": 3, \"negative\": -3, \"real\": 2.5, \"big\": 18446744073709551615,"
+								 " \"text\": \"beta\", \"flag\": true, \"list\": [1]}");
+
+	// Numbers are compared by value, whatever their representation is
+	REQUIRE (EventFilter::where ("int", FilterOperator::Equal, 3.0).matches (payload));
+	REQUIRE (EventFilter::where ("int", FilterOperator::Greater, 2.5).matches (payload));
+	REQUIRE (EventFilter::where ("real", FilterOperator::Less, 3).matches (payload));
+	REQUIRE (EventFilter::where ("negative", FilterOperator::Less, Json::UInt (1)).matches (payload));
+	REQUIRE (EventFilter::where ("big", FilterOperator::Greater, 0).matches (payload));
+	REQUIRE (EventFilter::where ("int", FilterOperator::LessEqual, 3).matches (payload));
+	REQUIRE (EventFilter::where ("int", FilterOperator::GreaterEqual, 3).matches (payload));
+
+	// Strings are compared in lexicographic order, a prefix comes first
+	REQUIRE (EventFilter::where ("text", FilterOperator::Equal, "beta").matches (payload));
+	REQUIRE (EventFilter::where ("text", FilterOperator::Greater, "alpha").matches (payload));
+	REQUIRE (EventFilter::where ("text", FilterOperator::Greater, "bet").matches (payload));
+	REQUIRE (EventFilter::where ("text", FilterOperator::Less, "betamax").matches (payload));
+	REQUIRE (EventFilter::where ("text", FilterOperator::Greater, "").matches (payload));
+	REQUIRE_FALSE (EventFilter::where ("text", FilterOperator::Less, "beta").matches (payload));
+
+	// Booleans are not numbers, values of different types are only different
+	REQUIRE_FALSE (EventFilter::where ("flag", FilterOperator::Equal, 1).matches (payload));
+	REQUIRE (EventFilter::where ("flag", FilterOperator::NotEqual, 1).matches (payload));
+	REQUIRE (EventFilter::where ("flag", FilterOperator::Equal, true).matches (payload));
+	REQUIRE_FALSE (EventFilter::where ("text", FilterOperator::Equal, 3).matches (payload));
+	REQUIRE_FALSE (EventFilter::where ("int", FilterOperator::Greater, "2").matches (payload));
+	REQUIRE_FALSE (EventFilter::where ("int", FilterOperator::Less, "2").matches (payload));
+	REQUIRE (EventFilter::where ("int", FilterOperator::NotEqual, "3").matches (payload));
+	REQUIRE (EventFilter::where ("list", FilterOperator::NotEqual, 1).matches (payload));
+	REQUIRE (EventFilter::where ("list", FilterOperator::Equal, parse ("[1]")).matches (payload));
+}
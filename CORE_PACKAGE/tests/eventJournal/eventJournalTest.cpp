@@ -0,0 +1,126 @@
+#define CATCH_CONFIG_MAIN
+
+#include <thirdParty/catch.hpp>
+#include <core/eventJournal.hpp>
+
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace microservicespp;
+using namespace utils;
+
+
+struct Record {
+	uint64_t offset;
+	string service;
+	string eventName;
+	string payload;
+};
+
+
+static vector<Record> readAll (EventJournal &journal, uint64_t fromOffset) {
+	vector<Record> records;
+	journal.replay (fromOffset, [&] (uint64_t offset, const string &service, const string &eventName, const string &payload) {
+		records.push_back (Record {offset, service, eventName, payload});
+	});
+	return records;
+}
+
+
+static string temporaryDirectory () {
+	char path[]	= "/tmp/eventJournalTestXXXXXX";
+	REQUIRE (mkdtemp (path) != nullptr);
+	return path;
+}
+
+
+TEST_CASE( "Appending and replaying records across segments" ) {
+	string directory	= temporaryDirectory ();
+	JournalOptions options;
+	options.segmentSize	= 256;
+
+	{
+		EventJournal journal (directory, options);
+		for (int i=0; i<100; i++)
+			REQUIRE (journal.append ("service", "event", to_string (i)) == static_cast<uint64_t> (i));
+		journal.sync (99);
+
+		REQUIRE (readAll (journal, 0).size () == 100);
+	}
+
+	EventJournal journal (directory, options);
+	REQUIRE (journal.nextOffset () == 100);
+
+	vector<Record> records	= readAll (journal, 42);
+	REQUIRE (records.size () == 58);
+	for (size_t i=0; i<records.size (); i++) {
+		REQUIRE (records[i].offset == 42 + i);
+		REQUIRE (records[i].service == "service");
+		REQUIRE (records[i].eventName == "event");
+		REQUIRE (records[i].payload == to_string (42 + i));
+	}
+
+	REQUIRE (journal.replay (100, [] (uint64_t, const string &, const string &, const string &) { FAIL (); }) == 100);
+	REQUIRE_THROWS (journal.append ("service", "event", string (256, 'x')));
+}
+
+
+TEST_CASE( "Recovering from a torn record" ) {
+	string directory	= temporaryDirectory ();
+	string segment		= directory + "/00000000000000000000.log";
+
+	{
+		EventJournal journal (directory);
+		journal.append ("service", "event", "first");
+		journal.sync (journal.append ("service", "event", "second"));
+	}
+
+	// Corrupts the payload of the last record, as a crash in the middle of a write would do
+	{
+		fstream file (segment, ios::in | ios::out | ios::binary);
+		string content (4096, '\0');
+		file.read (&content[0], content.size ());
+		size_t last	= content.find ("second");
+		file.seekp (last);
+		file.write ("SECOND", 6);
+	}
+
+	EventJournal journal (directory);
+	REQUIRE (journal.nextOffset () == 1);
+
+	journal.append ("service", "event", "third");
+	vector<Record> records	= readAll (journal, 0);
+	REQUIRE (records.size () == 2);
+	REQUIRE (records[0].payload == "first");
+	REQUIRE (records[1].payload == "third");
+}
+
+
+TEST_CASE( "Reserving the blocks of segments" ) {
+	string directory	= temporaryDirectory ();
+	JournalOptions options;
+	options.segmentSize	= 1 << 20;
+
+	struct stat info;
+	{
+		EventJournal journal (directory, options);
+		REQUIRE (stat ((directory + "/00000000000000000000.log").c_str (), &info) == 0);
+		REQUIRE (info.st_blocks * 512 >= options.segmentSize);
+	}
+
+	// A sparse segment left by a previous run is reserved when opened, since it may receive appends
+	string sparse	= directory + "/00000000000000000000.log";
+	REQUIRE (unlink (sparse.c_str ()) == 0);
+	{
+		ofstream file (sparse);
+	}
+	REQUIRE (truncate (sparse.c_str (), options.segmentSize) == 0);
+
+	EventJournal journal (directory, options);
+	REQUIRE (stat (sparse.c_str (), &info) == 0);
+	REQUIRE (info.st_blocks * 512 >= options.segmentSize);
+}
@@ -0,0 +1,1208 @@
+#define CATCH_CONFIG_MAIN
+
+#include <thirdParty/catch.hpp>
+#include <core/microservicespp.hpp>
+#include <engineDouble.hpp>
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <string>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+using namespace microservicespp;
+
+
+// EventManager keeps its interface to the Engine: this makes it reachable by the tests, on behalf of an Engine double
+class TestEventManager : private doubles::EngineHolder, public EventManager {
+	public :
+		TestEventManager () : EventManager (engineDouble) {}
+
+		using EventManager::serviceJoin;
+		using EventManager::serviceLeave;
+		using EventManager::holdSubscriptions;
+		using EventManager::pauseSubscriptions;
+		using EventManager::swapSubscriptions;
+		using EventManager::registerEvent;
+		using EventManager::getEventId;
+		using EventManager::onEvent;
+		using EventManager::onEventPattern;
+		using EventManager::triggerEvent;
+		using EventManager::triggerEvents;
+		using EventManager::unsubscribe;
+		using EventManager::getSubscriptionStats;
+		using EventManager::aggregateEvent;
+		using EventManager::resumeSubscription;
+		using EventManager::takeDeadLetters;
+		using EventManager::setServiceRateLimit;
+		using EventManager::getRateLimitStats;
+		using EventManager::getServiceRateLimitStats;
+		using EventManager::onRequest;
+		using EventManager::request;
+		using EventManager::onTypedEvent;
+		using EventManager::triggerTypedEvent;
+		using EventManager::setLatencyTracing;
+		using EventManager::getLatencyStats;
+		using EventManager::setReplicas;
+		using EventManager::joinReplica;
+		using EventManager::completeReplicas;
+};
+
+
+// Typed payload with a json form
+struct Reading {
+	int sensor;
+	double value;
+};
+
+// Typed payload without json form
+struct Sample {
+	int value;
+};
+
+namespace microservicespp {
+	template <>
+	struct JsonConverter<Reading> {
+		static Json::Value toJson (const Reading &reading) {
+			Json::Value json;
+			json["sensor"]	= reading.sensor;
+			json["value"]	= reading.value;
+			return json;
+		}
+
+		static Reading fromJson (const Json::Value &json) {
+			return Reading {json["sensor"].asInt (), json["value"].asDouble ()};
+		}
+	};
+}
+
+
+// Holds handlers until it is opened, counting the ones waiting on it
+class Gate {
+	private :
+		mutex gateMutex;
+		condition_variable condition;
+		bool opened;
+
+	public :
+		atomic<unsigned> waiting;
+
+		Gate () : opened (false), waiting (0) {}
+
+		void pass () {
+			unique_lock<mutex> lock (gateMutex);
+			waiting++;
+			condition.wait (lock, [this] { return opened; });
+		}
+
+		void open () {
+			{
+				unique_lock<mutex> lock (gateMutex);
+				opened	= true;
+			}
+			condition.notify_all ();
+		}
+};
+
+
+// Collects payloads from handlers, which run on dispatcher threads
+class Received {
+	private :
+		mutex receivedMutex;
+		vector<int> values;
+
+	public :
+		void add (int value) {
+			unique_lock<mutex> lock (receivedMutex);
+			values.push_back (value);
+		}
+
+		vector<int> get () {
+			unique_lock<mutex> lock (receivedMutex);
+			return values;
+		}
+};
+
+
+template <typename Predicate>
+static bool eventually (Predicate predicate) {
+	for (int i=0; i<2000 && !predicate (); i++)
+		this_thread::sleep_for (chrono::milliseconds (1));
+	return predicate ();
+}
+
+
+static vector<int> range (int from, int to) {
+	vector<int> values;
+	for (int i=from; i<to; i++)
+		values.push_back (i);
+	return values;
+}
+
+
+
+
+TEST_CASE( "Dispatching payloads in order" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+	EventId humidity	= manager.registerEvent ("sensors", "humidity");
+
+	Received received, matched;
+	manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { received.add (value.asInt ()); }));
+	manager.onEventPattern ("sensors/*", PatternEventHandler ([&] (EventId event, SharedPayload value) {
+		matched.add (event == humidity ? -value->asInt () : value->asInt ());
+	}));
+
+	for (int i=0; i<100; i++)
+		manager.triggerEvent (temperature, Json::Value (i));
+	manager.triggerEvent (humidity, Json::Value (7));
+
+	REQUIRE (eventually ([&] { return received.get ().size () == 100 && matched.get ().size () == 101; }));
+	REQUIRE (received.get () == range (0, 100));
+
+	vector<int> expected	= range (0, 100);
+	expected.push_back (-7);
+	REQUIRE (matched.get () == expected);
+
+	REQUIRE_THROWS_AS (manager.registerEvent ("sensors", "temperature"), exceptions::EventManagerException);
+	REQUIRE_THROWS_AS (manager.registerEvent ("unknown", "temperature"), exceptions::EventManagerException);
+}
+
+
+
+
+TEST_CASE( "Applying backpressure policies" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+
+	// The first payload holds the handler, the next four fill the queue and the last two overflow it
+	auto overflow	= [&] (BackpressurePolicy policy, vector<int> expected, uint64_t dropped, uint64_t coalesced) {
+		Gate gate;
+		Received received;
+		SubscriptionOptions options;
+		options.queueCapacity	= 4;
+		options.backpressure	= policy;
+		SubscriptionId id		= manager.onEvent (temperature, EventHandler ([&] (Json::Value value) {
+			if (value.asInt () == 0)
+				gate.pass ();
+			received.add (value.asInt ());
+		}), options);
+
+		manager.triggerEvent (temperature, Json::Value (0));
+		REQUIRE (eventually ([&] { return gate.waiting == 1; }));
+		for (int i=1; i<7; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+
+		SubscriptionStats stats	= manager.getSubscriptionStats (id);
+		REQUIRE (stats.queueDepth == 4);
+		REQUIRE (stats.dropped == dropped);
+		REQUIRE (stats.coalesced == coalesced);
+
+		gate.open ();
+		REQUIRE (eventually ([&] { return received.get ().size () == expected.size (); }));
+		REQUIRE (received.get () == expected);
+		REQUIRE (manager.getSubscriptionStats (id).delivered == expected.size ());
+		manager.unsubscribe (id);
+	};
+
+	SECTION( "DropNewest" ) {
+		overflow (BackpressurePolicy::DropNewest, {0, 1, 2, 3, 4}, 2, 0);
+	}
+	SECTION( "DropOldest" ) {
+		overflow (BackpressurePolicy::DropOldest, {0, 3, 4, 5, 6}, 2, 0);
+	}
+	SECTION( "Coalesce" ) {
+		overflow (BackpressurePolicy::Coalesce, {0, 1, 2, 3, 6}, 0, 2);
+	}
+
+	SECTION( "Block" ) {
+		Gate gate;
+		Received received;
+		SubscriptionOptions options;
+		options.queueCapacity	= 1;
+		manager.onEvent (temperature, EventHandler ([&] (Json::Value value) {
+			if (value.asInt () == 0)
+				gate.pass ();
+			received.add (value.asInt ());
+		}), options);
+
+		manager.triggerEvent (temperature, Json::Value (0));
+		REQUIRE (eventually ([&] { return gate.waiting == 1; }));
+
+		atomic<int> published (1);
+		thread publisher ([&] {
+			for (; published<4; published++)
+				manager.triggerEvent (temperature, Json::Value (published.load ()));
+		});
+
+		// The publisher fills the queue with the second payload and waits on the third
+		this_thread::sleep_for (chrono::milliseconds (50));
+		REQUIRE (published == 2);
+
+		gate.open ();
+		publisher.join ();
+		REQUIRE (eventually ([&] { return received.get ().size () == 4; }));
+		REQUIRE (received.get () == range (0, 4));
+	}
+}
+
+
+
+
+TEST_CASE( "Serving high priority payloads first" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("control");
+	manager.serviceJoin ("sensors");
+
+	EventOptions high, low;
+	high.priority	= EventPriority::High;
+	low.priority	= EventPriority::Low;
+	EventId hold		= manager.registerEvent ("control", "hold");
+	EventId normalEvent	= manager.registerEvent ("sensors", "normal");
+	EventId highEvent	= manager.registerEvent ("sensors", "high", high);
+	EventId lowEvent	= manager.registerEvent ("sensors", "low", low);
+
+	// Every dispatcher but the high lane one is held, as many as the manager starts
+	unsigned held	= max (2u, thread::hardware_concurrency ()) - 1;
+	Gate gate;
+	for (unsigned i=0; i<held; i++)
+		manager.onEvent (hold, EventHandler ([&] (Json::Value) { gate.pass (); }));
+	manager.triggerEvent (hold, Json::Value (0));
+	REQUIRE (eventually ([&] { return gate.waiting == held; }));
+
+	Received received;
+	manager.onEventPattern ("sensors/*", PatternEventHandler ([&] (EventId, SharedPayload value) {
+		received.add (value->asInt ());
+	}));
+
+	for (int i=0; i<3; i++)
+		manager.triggerEvent (lowEvent, Json::Value (100 + i));
+	for (int i=0; i<3; i++)
+		manager.triggerEvent (normalEvent, Json::Value (200 + i));
+	manager.triggerEvent (highEvent, Json::Value (1));
+
+	// The mailbox waiting in the low lane moves to the high one, leaving the rest to the other dispatchers
+	REQUIRE (eventually ([&] { return received.get ().size () == 1; }));
+	this_thread::sleep_for (chrono::milliseconds (20));
+	REQUIRE (received.get () == vector<int> ({1}));
+
+	gate.open ();
+	REQUIRE (eventually ([&] { return received.get ().size () == 7; }));
+	REQUIRE (received.get () == vector<int> ({1, 200, 201, 202, 100, 101, 102}));
+}
+
+
+
+
+TEST_CASE( "Handling payloads inline" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+
+	SubscriptionOptions options;
+	options.inlineDispatch	= true;
+	options.inlineBudget	= 1000000;
+
+	SECTION( "On the publisher thread" ) {
+		vector<thread::id> threads;
+		SubscriptionId id	= manager.onEvent (temperature, EventHandler ([&] (Json::Value) {
+			threads.push_back (this_thread::get_id ());
+		}), options);
+
+		for (int i=0; i<10; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+
+		REQUIRE (threads == vector<thread::id> (10, this_thread::get_id ()));
+		SubscriptionStats stats	= manager.getSubscriptionStats (id);
+		REQUIRE (stats.inlined);
+		REQUIRE (stats.delivered == 10);
+	}
+
+	SECTION( "Subscribing from the handler" ) {
+		Received received;
+		bool subscribed	= false;
+		manager.onEvent (temperature, EventHandler ([&] (Json::Value) {
+			if (subscribed)
+				return;
+			subscribed			= true;
+			EventId humidity	= manager.registerEvent ("sensors", "humidity");
+			manager.onEvent (humidity, EventHandler ([&] (Json::Value value) { received.add (value.asInt ()); }));
+			manager.triggerEvent (humidity, Json::Value (42));
+		}), options);
+
+		manager.triggerEvent (temperature, Json::Value (0));
+		REQUIRE (subscribed);
+		REQUIRE (eventually ([&] { return received.get ().size () == 1; }));
+		REQUIRE (received.get () == vector<int> ({42}));
+	}
+}
+
+
+
+
+TEST_CASE( "Reloading the subscriptions of a service" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	manager.serviceJoin ("monitor");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+
+	SubscriptionOptions options;
+	options.owner	= "monitor";
+
+	Received oldReceived, newReceived;
+	manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { oldReceived.add (value.asInt ()); }), options);
+	for (int i=0; i<10; i++)
+		manager.triggerEvent (temperature, Json::Value (i));
+	REQUIRE (eventually ([&] { return oldReceived.get ().size () == 10; }));
+
+	// The new instance joins and subscribes while the old one is still served
+	manager.holdSubscriptions ("monitor");
+	manager.serviceJoin ("monitor");
+	manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { newReceived.add (value.asInt ()); }), options);
+	manager.triggerEvent (temperature, Json::Value (10));
+	REQUIRE (eventually ([&] { return oldReceived.get ().size () == 11; }));
+
+	SECTION( "Committed" ) {
+		// Payloads triggered during the pause are buffered and handed to the new instance
+		manager.pauseSubscriptions ("monitor");
+		for (int i=11; i<20; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+		manager.swapSubscriptions ("monitor", true);
+		manager.serviceLeave ("monitor");
+
+		for (int i=20; i<30; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+
+		REQUIRE (eventually ([&] { return newReceived.get ().size () == 19; }));
+		REQUIRE (oldReceived.get () == range (0, 11));
+		REQUIRE (newReceived.get () == range (11, 30));
+	}
+
+	SECTION( "Rolled back" ) {
+		manager.pauseSubscriptions ("monitor");
+		for (int i=11; i<20; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+		manager.swapSubscriptions ("monitor", false);
+		manager.serviceLeave ("monitor");
+
+		REQUIRE (eventually ([&] { return oldReceived.get ().size () == 20; }));
+		REQUIRE (oldReceived.get () == range (0, 20));
+		REQUIRE (newReceived.get ().empty ());
+	}
+
+	SECTION( "Invalid patterns of the new instance" ) {
+		// Refused when subscribing, not when the swap attaches them
+		PatternEventHandler handler	= [&] (EventId, SharedPayload value) { newReceived.add (-1); };
+		REQUIRE_THROWS_AS (manager.onEventPattern ("sensors/**/temperature", handler, options), exceptions::EventManagerException);
+
+		manager.pauseSubscriptions ("monitor");
+		manager.swapSubscriptions ("monitor", true);
+		manager.serviceLeave ("monitor");
+
+		for (int i=11; i<20; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+
+		REQUIRE (eventually ([&] { return newReceived.get ().size () == 9; }));
+		REQUIRE (newReceived.get () == range (11, 20));
+	}
+}
+
+
+
+
+TEST_CASE( "Pausing waits for inline handlers" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	manager.serviceJoin ("monitor");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+
+	SubscriptionOptions options;
+	options.owner			= "monitor";
+	options.inlineDispatch	= true;
+	options.inlineBudget	= 1000000;
+
+	Gate gate;
+	manager.onEvent (temperature, EventHandler ([&] (Json::Value) { gate.pass (); }), options);
+
+	thread publisher ([&] { manager.triggerEvent (temperature, Json::Value (0)); });
+	REQUIRE (eventually ([&] { return gate.waiting == 1; }));
+
+	manager.holdSubscriptions ("monitor");
+	atomic<bool> paused (false);
+	thread reloader ([&] {
+		manager.pauseSubscriptions ("monitor");
+		paused	= true;
+	});
+
+	this_thread::sleep_for (chrono::milliseconds (50));
+	REQUIRE_FALSE (paused);
+
+	gate.open ();
+	publisher.join ();
+	reloader.join ();
+	REQUIRE (paused);
+	manager.swapSubscriptions ("monitor", false);
+}
+
+
+
+
+TEST_CASE( "Cancelling subscriptions of a service which leaves" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	manager.serviceJoin ("monitor");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+
+	SubscriptionOptions options;
+	options.owner	= "monitor";
+
+	Received owned, other;
+	SubscriptionId ownedId	= manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { owned.add (value.asInt ()); }), options);
+	SubscriptionId otherId	= manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { other.add (value.asInt ()); }));
+
+	manager.triggerEvent (temperature, Json::Value (0));
+	REQUIRE (eventually ([&] { return owned.get ().size () == 1 && other.get ().size () == 1; }));
+
+	manager.serviceLeave ("monitor");
+	REQUIRE_THROWS_AS (manager.getSubscriptionStats (ownedId), exceptions::EventManagerException);
+	REQUIRE_THROWS_AS (manager.serviceLeave ("monitor"), exceptions::EventManagerException);
+
+	manager.triggerEvent (temperature, Json::Value (1));
+	REQUIRE (eventually ([&] { return other.get ().size () == 2; }));
+	REQUIRE (owned.get () == vector<int> ({0}));
+	REQUIRE (manager.getSubscriptionStats (otherId).delivered == 2);
+
+	// Subscriptions to events of a service which leaves are kept for its return
+	manager.serviceLeave ("sensors");
+	manager.serviceJoin ("sensors");
+	REQUIRE (manager.registerEvent ("sensors", "temperature") == temperature);
+	manager.triggerEvent (temperature, Json::Value (2));
+	REQUIRE (eventually ([&] { return other.get ().size () == 3; }));
+}
+
+
+
+
+
+TEST_CASE( "Delivering typed payloads" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventId readings	= manager.registerEvent ("sensors", "readings");
+	EventId samples		= manager.registerEvent ("sensors", "samples");
+
+	SECTION( "Converted only for json subscribers" ) {
+		Received typed, json;
+		manager.onTypedEvent<Reading> (readings, [&] (const Reading &reading) { typed.add (reading.sensor); });
+		manager.onEvent (readings, EventHandler ([&] (Json::Value value) { json.add (value["sensor"].asInt ()); }));
+
+		manager.triggerTypedEvent (readings, Reading {1, 20.5});
+		Json::Value payload;
+		payload["sensor"]	= 2;
+		payload["value"]	= 21.5;
+		manager.triggerEvent (readings, payload);
+
+		REQUIRE (eventually ([&] { return typed.get ().size () == 2 && json.get ().size () == 2; }));
+		REQUIRE (typed.get () == vector<int> ({1, 2}));
+		REQUIRE (json.get () == vector<int> ({1, 2}));
+	}
+
+	SECTION( "Types without JsonConverter" ) {
+		REQUIRE (HasJsonConverter<Reading>::value);
+		REQUIRE_FALSE (HasJsonConverter<Sample>::value);
+
+		Received typed;
+		manager.onTypedEvent<Sample> (samples, [&] (const Sample &sample) { typed.add (sample.value); });
+		manager.triggerTypedEvent (samples, Sample {1});
+		REQUIRE (eventually ([&] { return typed.get ().size () == 1; }));
+
+		// A subscriber needing json makes the trigger fail before anyone gets the payload
+		SubscriptionOptions options;
+		options.filter			= EventFilter::where ("value", FilterOperator::Greater, 0);
+		SubscriptionId filtered	= manager.onTypedEvent<Sample> (samples, [&] (const Sample &sample) { typed.add (-sample.value); }, options);
+		REQUIRE_THROWS_AS (manager.triggerTypedEvent (samples, Sample {2}), exceptions::EventManagerException);
+
+		manager.unsubscribe (filtered);
+		manager.onEvent (samples, EventHandler ([&] (Json::Value) {}));
+		REQUIRE_THROWS_AS (manager.triggerTypedEvent (samples, Sample {3}), exceptions::EventManagerException);
+
+		this_thread::sleep_for (chrono::milliseconds (20));
+		REQUIRE (typed.get () == vector<int> ({1}));
+	}
+}
+
+
+
+
+TEST_CASE( "Triggering batches of payloads" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+	EventId humidity	= manager.registerEvent ("sensors", "humidity");
+
+	SECTION( "Handled together by batch handlers" ) {
+		Gate gate;
+		Received received;
+		mutex sizesMutex;
+		vector<size_t> sizes;
+		manager.onEvent (temperature, BatchEventHandler ([&] (const vector<SharedPayload> &payloads) {
+			if (payloads.front ()->asInt () == 0)
+				gate.pass ();
+			for (auto &payload : payloads)
+				received.add (payload->asInt ());
+			unique_lock<mutex> lock (sizesMutex);
+			sizes.push_back (payloads.size ());
+		}));
+
+		manager.triggerEvent (temperature, Json::Value (0));
+		REQUIRE (eventually ([&] { return gate.waiting == 1; }));
+
+		vector<Json::Value> payloads;
+		for (int i=1; i<11; i++)
+			payloads.push_back (Json::Value (i));
+		manager.triggerEvents (temperature, payloads);
+
+		gate.open ();
+		REQUIRE (eventually ([&] { return received.get ().size () == 11; }));
+		REQUIRE (received.get () == range (0, 11));
+		unique_lock<mutex> lock (sizesMutex);
+		REQUIRE (sizes == vector<size_t> ({1, 10}));
+	}
+
+	SECTION( "Of several events, checked before delivering anything" ) {
+		Received received;
+		manager.onEventPattern ("sensors/*", PatternEventHandler ([&] (EventId event, SharedPayload value) {
+			received.add (event == humidity ? -value->asInt () : value->asInt ());
+		}));
+
+		vector<pair<EventId, SharedPayload>> events;
+		for (int i=1; i<4; i++) {
+			events.push_back (make_pair (temperature, make_shared<const Json::Value> (i)));
+			events.push_back (make_pair (humidity, make_shared<const Json::Value> (i)));
+		}
+		manager.triggerEvents (events);
+		REQUIRE (eventually ([&] { return received.get ().size () == 6; }));
+
+		// Payloads of each event keep their order
+		vector<int> temperatures, humidities;
+		for (int value : received.get ())
+			(value > 0 ? temperatures : humidities).push_back (value);
+		REQUIRE (temperatures == vector<int> ({1, 2, 3}));
+		REQUIRE (humidities == vector<int> ({-1, -2, -3}));
+
+		EventId unregistered	= manager.getEventId ("sensors", "pressure");
+		events.push_back (make_pair (unregistered, make_shared<const Json::Value> (4)));
+		REQUIRE_THROWS_AS (manager.triggerEvents (events), exceptions::EventManagerException);
+
+		this_thread::sleep_for (chrono::milliseconds (20));
+		REQUIRE (received.get ().size () == 6);
+	}
+}
+
+
+
+TEST_CASE( "Conflating payloads not yet handled" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("robot");
+	EventOptions conflated;
+	conflated.conflated	= true;
+	EventId position	= manager.registerEvent ("robot", "position", conflated);
+	EventId alarm		= manager.registerEvent ("robot", "alarm");
+
+	Gate gate;
+	Received received;
+	SubscriptionOptions options;
+	options.queueCapacity	= 2;
+	options.backpressure	= BackpressurePolicy::DropNewest;
+	SubscriptionId id		= manager.onEventPattern ("robot/*", PatternEventHandler ([&] (EventId event, SharedPayload value) {
+		if (value->asInt () == 0)
+			gate.pass ();
+		received.add (event == alarm ? -value->asInt () : value->asInt ());
+	}), options);
+
+	manager.triggerEvent (position, Json::Value (0));
+	REQUIRE (eventually ([&] { return gate.waiting == 1; }));
+
+	// The latest position replaces in place the pending one, taking no room in the queue
+	for (int i=1; i<6; i++)
+		manager.triggerEvent (position, Json::Value (i));
+	manager.triggerEvent (alarm, Json::Value (1));
+	manager.triggerEvent (position, Json::Value (6));
+
+	SubscriptionStats stats	= manager.getSubscriptionStats (id);
+	REQUIRE (stats.queueDepth == 2);
+	REQUIRE (stats.conflated == 5);
+	REQUIRE (stats.dropped == 0);
+
+	gate.open ();
+	REQUIRE (eventually ([&] { return received.get ().size () == 3; }));
+	REQUIRE (received.get () == vector<int> ({0, 6, -1}));
+
+	// Once handled, a payload is not replaced anymore
+	manager.triggerEvent (position, Json::Value (7));
+	REQUIRE (eventually ([&] { return received.get ().size () == 4; }));
+	REQUIRE (manager.getSubscriptionStats (id).conflated == 5);
+}
+
+
+
+
+TEST_CASE( "Delivering the last value of sticky events" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventOptions sticky;
+	sticky.sticky		= true;
+	EventId temperature	= manager.registerEvent ("sensors", "temperature", sticky);
+
+	SubscriptionOptions lastValue;
+	lastValue.lastValue	= true;
+
+	// Nothing is cached yet
+	Received early;
+	manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { early.add (value.asInt ()); }), lastValue);
+
+	for (int i=0; i<3; i++)
+		manager.triggerEvent (temperature, Json::Value (i));
+	REQUIRE (eventually ([&] { return early.get ().size () == 3; }));
+
+	// Only the latest payload is delivered, at once and once, to subscriptions asking for it
+	Received late, plain, filtered;
+	manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { late.add (value.asInt ()); }), lastValue);
+	manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { plain.add (value.asInt ()); }));
+	SubscriptionOptions filter	= lastValue;
+	filter.filter				= EventFilter::where ("celsius", FilterOperator::Exists);
+	SubscriptionId filteredId	= manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { filtered.add (value.asInt ()); }),
+												   filter);
+
+	REQUIRE (eventually ([&] { return late.get ().size () == 1; }));
+	manager.triggerEvent (temperature, Json::Value (1));
+	REQUIRE (eventually ([&] { return late.get ().size () == 2 && plain.get ().size () == 1; }));
+	REQUIRE (late.get () == vector<int> ({2, 1}));
+	REQUIRE (plain.get () == vector<int> ({1}));
+
+	// The cached payload goes through the filter too
+	REQUIRE (filtered.get ().empty ());
+	REQUIRE (manager.getSubscriptionStats (filteredId).filtered == 2);
+	REQUIRE (eventually ([&] { return early.get ().size () == 4; }));
+	REQUIRE (early.get () == vector<int> ({0, 1, 2, 1}));
+
+	// A cached payload goes through the mailbox, which inline handlers skip
+	lastValue.inlineDispatch	= true;
+	REQUIRE_THROWS_AS (manager.onEvent (temperature, EventHandler ([] (Json::Value) {}), lastValue), exceptions::EventManagerException);
+}
+
+
+
+
+TEST_CASE( "Handling partitions of a subscription in parallel" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("orders");
+	// The high lane is served by every dispatcher, so two of them are there in any case
+	EventOptions high;
+	high.priority	= EventPriority::High;
+	EventId placed	= manager.registerEvent ("orders", "placed", high);
+
+	const size_t partitions	= 4;
+	auto partitionOf		= [&] (const string &key) { return hash<string> () (key) % partitions; };
+
+	Gate gate;
+	mutex handledMutex;
+	map<string, vector<int>> handled;
+	SubscriptionOptions options;
+	options.partitions		= partitions;
+	options.partitionKey	= [] (const Json::Value &order) { return order["customer"].asString (); };
+	manager.onEvent (placed, EventHandler ([&] (Json::Value order) {
+		if (order["customer"] == "c0" && order["index"] == 0)
+			gate.pass ();
+		unique_lock<mutex> lock (handledMutex);
+		handled[order["customer"].asString ()].push_back (order["index"].asInt ());
+	}), options);
+
+	auto place	= [&] (int customer, int index) {
+		Json::Value order;
+		order["customer"]	= "c" + to_string (customer);
+		order["index"]		= index;
+		manager.triggerEvent (placed, order);
+	};
+
+	place (0, 0);
+	REQUIRE (eventually ([&] { return gate.waiting == 1; }));
+	for (int index=0; index<5; index++) {
+		for (int customer=0; customer<8; customer++) {
+			if (customer != 0 || index != 0)
+				place (customer, index);
+		}
+	}
+
+	// Customers in other partitions than the held one are served meanwhile
+	auto handledCount	= [&] (const string &customer) {
+		unique_lock<mutex> lock (handledMutex);
+		return handled[customer].size ();
+	};
+	for (int customer=1; customer<8; customer++) {
+		string key	= "c" + to_string (customer);
+		if (partitionOf (key) != partitionOf ("c0"))
+			REQUIRE (eventually ([&] { return handledCount (key) == 5; }));
+		else
+			REQUIRE (handledCount (key) == 0);
+	}
+
+	gate.open ();
+	for (int customer=0; customer<8; customer++)
+		REQUIRE (eventually ([&] { return handledCount ("c" + to_string (customer)) == 5; }));
+
+	// Orders of each customer are handled in order
+	unique_lock<mutex> lock (handledMutex);
+	for (auto &customer : handled)
+		REQUIRE (customer.second == range (0, 5));
+}
+
+
+
+
+TEST_CASE( "Sharing subscriptions among replicas of a service" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+	EventId humidity	= manager.registerEvent ("sensors", "humidity");
+
+	const unsigned replicas	= 3;
+	ReplicaOptions replication;
+	replication.replicas	= replicas;
+	manager.setReplicas ("monitor", replication);
+
+	SubscriptionOptions options;
+	options.owner	= "monitor";
+
+	Received received[replicas];
+	auto handlerOf	= [&] (unsigned replica) {
+		return EventHandler ([&, replica] (Json::Value value) { received[replica].add (value.asInt ()); });
+	};
+	auto total		= [&] {
+		size_t count	= 0;
+		for (auto &replica : received)
+			count	+= replica.get ().size ();
+		return count;
+	};
+
+	SECTION( "Payloads wait for all replicas" ) {
+		SubscriptionId shared	= 0;
+		for (unsigned replica=0; replica<replicas; replica++) {
+			manager.joinReplica ("monitor", replica);
+			manager.serviceJoin ("monitor");
+			shared	= manager.onEvent (temperature, handlerOf (replica), options);
+			manager.triggerEvent (temperature, Json::Value (static_cast<int> (replica)));
+		}
+
+		// Replicas share a subscription, which keeps payloads until the last replica joined
+		REQUIRE (manager.getSubscriptionStats (shared).queueDepth == replicas);
+		REQUIRE (total () == 0);
+
+		manager.completeReplicas ("monitor");
+		for (int value=replicas; value<60; value++)
+			manager.triggerEvent (temperature, Json::Value (value));
+		REQUIRE (eventually ([&] { return total () == 60; }));
+
+		vector<int> values;
+		for (auto &replica : received) {
+			vector<int> handled	= replica.get ();
+			values.insert (values.end (), handled.begin (), handled.end ());
+		}
+		sort (values.begin (), values.end ());
+		REQUIRE (values == range (0, 60));
+	}
+
+	SECTION( "Payloads with the same key go to the same replica" ) {
+		replication.balance		= BalancePolicy::KeyAffinity;
+		replication.affinityKey	= [] (const Json::Value &value) { return to_string (value.asInt () % 7); };
+		manager.setReplicas ("monitor", replication);
+
+		for (unsigned replica=0; replica<replicas; replica++) {
+			manager.joinReplica ("monitor", replica);
+			manager.onEvent (temperature, handlerOf (replica), options);
+			// Payloads buffered before the last replica joined are balanced among all of them as well
+			manager.triggerEvent (temperature, Json::Value (static_cast<int> (replica)));
+		}
+		manager.completeReplicas ("monitor");
+		for (int value=replicas; value<70; value++)
+			manager.triggerEvent (temperature, Json::Value (value));
+		REQUIRE (eventually ([&] { return total () == 70; }));
+
+		map<int, unsigned> replicaOfKey;
+		for (unsigned replica=0; replica<replicas; replica++) {
+			vector<int> handled	= received[replica].get ();
+			REQUIRE (is_sorted (handled.begin (), handled.end ()));
+			for (int value : handled) {
+				auto keyIt	= replicaOfKey.insert (make_pair (value % 7, replica)).first;
+				REQUIRE (keyIt->second == replica);
+			}
+		}
+	}
+
+	SECTION( "Subscriptions of a replica to the same event join different groups" ) {
+		Received second;
+		for (unsigned replica=0; replica<replicas; replica++) {
+			manager.joinReplica ("monitor", replica);
+			manager.onEvent (temperature, handlerOf (replica), options);
+			manager.onEvent (temperature, EventHandler ([&] (Json::Value value) { second.add (value.asInt ()); }), options);
+		}
+		manager.completeReplicas ("monitor");
+
+		for (int value=0; value<30; value++)
+			manager.triggerEvent (temperature, Json::Value (value));
+		REQUIRE (eventually ([&] { return total () == 30 && second.get ().size () == 30; }));
+	}
+
+	SECTION( "Replicas making different subscriptions" ) {
+		manager.joinReplica ("monitor", 0);
+		manager.onEvent (temperature, handlerOf (0), options);
+
+		// Payloads are balanced among replicas, not partitioned
+		SubscriptionOptions partitioned	= options;
+		partitioned.partitionKey		= [] (const Json::Value &value) { return value.asString (); };
+		REQUIRE_THROWS_AS (manager.onEvent (humidity, handlerOf (0), partitioned), exceptions::EventManagerException);
+
+		manager.joinReplica ("monitor", 1);
+		SubscriptionOptions smaller	= options;
+		smaller.queueCapacity		= 16;
+		REQUIRE_THROWS_AS (manager.onEvent (temperature, handlerOf (1), smaller), exceptions::EventManagerException);
+		REQUIRE_THROWS_AS (manager.onEvent (humidity, handlerOf (1), options), exceptions::EventManagerException);
+		manager.onEvent (temperature, handlerOf (1), options);
+
+		REQUIRE_THROWS_AS (manager.joinReplica ("monitor", 0), exceptions::EventManagerException);
+		manager.joinReplica ("monitor", 2);
+		REQUIRE_THROWS_AS (manager.completeReplicas ("monitor"), exceptions::EventManagerException);
+
+		// Once replicas started, none of them can subscribe anymore
+		REQUIRE_THROWS_AS (manager.onEvent (temperature, handlerOf (2), options), exceptions::EventManagerException);
+	}
+}
+
+
+
+
+TEST_CASE( "Answering requests" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("calculator");
+	EventId add	= manager.getEventId ("calculator", "add");
+
+	REQUIRE_THROWS_AS (manager.request (add, Json::Value (0)), exceptions::EventManagerException);
+
+	Gate gate;
+	atomic<unsigned> answered (0);
+	manager.onRequest ("calculator", "add", [&] (const Json::Value &operands) {
+		if (operands.isNull ())
+			gate.pass ();
+		if (operands.isString ())
+			throw runtime_error (operands.asString ());
+		answered++;
+		return Json::Value (operands[0].asInt () + operands[1].asInt ());
+	});
+	REQUIRE_THROWS_AS (manager.onRequest (add, [] (const Json::Value &) { return Json::Value (); }), exceptions::EventManagerException);
+
+	SECTION( "Replies and failures" ) {
+		Json::Value operands;
+		operands.append (2);
+		operands.append (3);
+		REQUIRE (manager.request (add, operands).get () == Json::Value (5));
+
+		// The exception of the responder is the one of the reply
+		future<Json::Value> failed	= manager.request ("calculator", "add", Json::Value ("overflow"));
+		REQUIRE_THROWS_WITH (failed.get (), "overflow");
+	}
+
+	SECTION( "Timeouts" ) {
+		future<Json::Value> held	= manager.request (add, Json::Value (), 5000);
+		REQUIRE (eventually ([&] { return gate.waiting == 1; }));
+
+		// Waiting behind the held request, this one expires before its responder sees it
+		Json::Value operands;
+		operands.append (1);
+		operands.append (1);
+		future<Json::Value> late	= manager.request (add, operands, 20);
+		REQUIRE_THROWS_AS (late.get (), exceptions::RequestTimeoutException);
+
+		gate.open ();
+		REQUIRE (held.get () == Json::Value (0));
+		this_thread::sleep_for (chrono::milliseconds (20));
+		REQUIRE (answered == 1);
+	}
+}
+
+
+
+
+TEST_CASE( "Limiting the rate of payloads" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+
+	Received received;
+	auto subscribe	= [&] (EventId event) {
+		manager.onEvent (event, EventHandler ([&] (Json::Value value) { received.add (value.asInt ()); }));
+	};
+
+	SECTION( "Of an event" ) {
+		EventOptions options;
+		options.rateLimit	= RateLimit (0.001, 3);
+		EventId temperature	= manager.registerEvent ("sensors", "temperature", options);
+		subscribe (temperature);
+
+		for (int i=0; i<5; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+
+		REQUIRE (eventually ([&] { return received.get ().size () == 3; }));
+		RateLimitStats stats	= manager.getRateLimitStats (temperature);
+		REQUIRE (stats.admitted == 3);
+		REQUIRE (stats.dropped == 2);
+		this_thread::sleep_for (chrono::milliseconds (20));
+		REQUIRE (received.get () == range (0, 3));
+	}
+
+	SECTION( "Of a service, before those of its events" ) {
+		EventOptions options;
+		options.rateLimit	= RateLimit (0.001, 5);
+		EventId temperature	= manager.registerEvent ("sensors", "temperature", options);
+		subscribe (temperature);
+		manager.setServiceRateLimit ("sensors", RateLimit (0.001, 2));
+
+		for (int i=0; i<4; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+
+		// Payloads dropped by the service do not use the budget of the event
+		RateLimitStats eventStats	= manager.getRateLimitStats (temperature);
+		RateLimitStats serviceStats	= manager.getServiceRateLimitStats ("sensors");
+		REQUIRE (serviceStats.admitted == 2);
+		REQUIRE (serviceStats.dropped == 2);
+		REQUIRE (eventStats.admitted == 2);
+		REQUIRE (eventStats.dropped == 0);
+
+		manager.setServiceRateLimit ("sensors", RateLimit ());
+		for (int i=4; i<8; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+
+		REQUIRE (eventually ([&] { return received.get ().size () == 5; }));
+		REQUIRE (received.get () == vector<int> ({0, 1, 4, 5, 6}));
+		REQUIRE (manager.getRateLimitStats (temperature).dropped == 1);
+	}
+
+	SECTION( "Delaying publishers" ) {
+		EventOptions options;
+		options.rateLimit	= RateLimit (100, 1, RateLimitPolicy::Delay);
+		EventId temperature	= manager.registerEvent ("sensors", "temperature", options);
+		subscribe (temperature);
+
+		auto start	= chrono::steady_clock::now ();
+		for (int i=0; i<4; i++)
+			manager.triggerEvent (temperature, Json::Value (i));
+		REQUIRE (chrono::steady_clock::now () - start >= chrono::milliseconds (25));
+
+		REQUIRE (eventually ([&] { return received.get ().size () == 4; }));
+		RateLimitStats stats	= manager.getRateLimitStats (temperature);
+		REQUIRE (stats.admitted == 4);
+		REQUIRE (stats.delayed == 3);
+	}
+
+	SECTION( "Rejecting rates tokens cannot represent" ) {
+		EventOptions options;
+		options.rateLimit	= RateLimit (1e-12, 1);
+		REQUIRE_THROWS_AS (manager.registerEvent ("sensors", "temperature", options), exceptions::EventManagerException);
+		REQUIRE_THROWS_AS (manager.setServiceRateLimit ("sensors", RateLimit (2e9, 1)), exceptions::EventManagerException);
+		REQUIRE_THROWS_AS (manager.setServiceRateLimit ("sensors", RateLimit (-1, 1)), exceptions::EventManagerException);
+		REQUIRE_THROWS_AS (manager.setServiceRateLimit ("sensors", RateLimit (10, 0)), exceptions::EventManagerException);
+	}
+}
+
+
+
+
+TEST_CASE( "Storing dead letters and suspending failing subscriptions" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+
+	// Two failures are tolerated at once, then failures may come only once in a thousand seconds
+	Received received;
+	SubscriptionOptions options;
+	options.maxFailureRate	= 0.001;
+	options.failureBurst	= 2;
+	SubscriptionId id		= manager.onEvent (temperature, EventHandler ([&] (Json::Value value) {
+		if (value.asInt () < 0)
+			throw runtime_error ("negative temperature " + to_string (value.asInt ()));
+		received.add (value.asInt ());
+	}), options);
+
+	for (int value : {1, -1, -2, 2})
+		manager.triggerEvent (temperature, Json::Value (value));
+	REQUIRE (eventually ([&] { return received.get ().size () == 2; }));
+	REQUIRE_FALSE (manager.getSubscriptionStats (id).suspended);
+
+	manager.triggerEvent (temperature, Json::Value (-3));
+	REQUIRE (eventually ([&] { return manager.getSubscriptionStats (id).suspended; }));
+
+	// Payloads of a suspended subscription are discarded
+	manager.triggerEvent (temperature, Json::Value (3));
+	this_thread::sleep_for (chrono::milliseconds (20));
+	REQUIRE (received.get () == vector<int> ({1, 2}));
+
+	manager.resumeSubscription (id);
+	manager.triggerEvent (temperature, Json::Value (4));
+	REQUIRE (eventually ([&] { return received.get ().size () == 3; }));
+	REQUIRE (received.get () == vector<int> ({1, 2, 4}));
+
+	SubscriptionStats stats	= manager.getSubscriptionStats (id);
+	REQUIRE (stats.failed == 3);
+	REQUIRE_FALSE (stats.suspended);
+
+	vector<DeadLetter> deadLetters	= manager.takeDeadLetters ();
+	REQUIRE (deadLetters.size () == 3);
+	for (size_t i=0; i<deadLetters.size (); i++) {
+		int value	= -static_cast<int> (i) - 1;
+		REQUIRE (deadLetters[i].subscription == id);
+		REQUIRE (deadLetters[i].event == temperature);
+		REQUIRE (deadLetters[i].object->asJson () == Json::Value (value));
+		REQUIRE (deadLetters[i].error == "negative temperature " + to_string (value));
+	}
+	REQUIRE (manager.takeDeadLetters ().empty ());
+}
+
+
+
+
+TEST_CASE( "Aggregating payloads over time windows" ) {
+	TestEventManager manager;
+	manager.serviceJoin ("sensors");
+	EventId temperature	= manager.registerEvent ("sensors", "temperature");
+	EventId statistics	= manager.registerEvent ("sensors", "statistics");
+
+	mutex windowsMutex;
+	vector<Json::Value> windows;
+	manager.onEvent (statistics, EventHandler ([&] (Json::Value window) {
+		unique_lock<mutex> lock (windowsMutex);
+		windows.push_back (window);
+	}));
+	auto received	= [&] () {
+		unique_lock<mutex> lock (windowsMutex);
+		return windows;
+	};
+
+	SECTION( "Sliding windows" ) {
+		manager.aggregateEvent (temperature, "reading.celsius", WindowOptions (200, 50), statistics);
+
+		for (int i=1; i<5; i++) {
+			Json::Value payload;
+			payload["reading"]["celsius"]	= i;
+			manager.triggerEvent (temperature, payload);
+		}
+		// Payloads without the numeric field are not counted
+		manager.triggerEvent (temperature, Json::Value ("broken"));
+
+		// The payloads stay in four windows, the first ones starting with the aggregation
+		REQUIRE (eventually ([&] { return received ().size () == 4; }));
+		this_thread::sleep_for (chrono::milliseconds (100));
+		vector<Json::Value> closed	= received ();
+		REQUIRE (closed.size () == 4);
+
+		for (size_t i=0; i<closed.size (); i++) {
+			Json::Value &window	= closed[i];
+			REQUIRE (window["count"].asUInt64 () == 4);
+			REQUIRE (window["sum"].asDouble () == 10);
+			REQUIRE (window["min"].asDouble () == 1);
+			REQUIRE (window["max"].asDouble () == 4);
+			REQUIRE (window["mean"].asDouble () == 2.5);
+			REQUIRE (window["end"].asInt64 () - window["start"].asInt64 () == 50 * static_cast<Json::Int64> (i + 1));
+		}
+	}
+
+	SECTION( "Rejected options" ) {
+		REQUIRE_THROWS_AS (manager.aggregateEvent (temperature, "", WindowOptions (100, 30), statistics), exceptions::EventManagerException);
+
+		SubscriptionOptions lastValue;
+		lastValue.lastValue	= true;
+		REQUIRE_THROWS_WITH (manager.aggregateEvent (temperature, "", WindowOptions (100), statistics, lastValue),
+							 "Aggregations cannot receive the last value of events");
+	}
+}
+
+
+
+
+// Number of handler latencies recorded for "subscription"
+static uint64_t handledCount (TestEventManager &manager, SubscriptionId subscription) {
+	uint64_t count	= 0;
+	for (auto &stats : manager.getLatencyStats ()) {
+		if (stats.subscription == subscription)
+			count	+= stats.handler.count ();
+	}
+	return count;
+}
+
+
+TEST_CASE( "Tracing latencies across threads and managers" ) {
+	SubscriptionOptions options;
+	options.inlineDispatch	= true;
+	options.inlineBudget	= 1000000;
+
+	SECTION( "Threads which exited" ) {
+		TestEventManager manager;
+		manager.serviceJoin ("sensors");
+		EventId temperature	= manager.registerEvent ("sensors", "temperature");
+		SubscriptionId id	= manager.onEvent (temperature, EventHandler ([] (Json::Value) {}), options);
+		manager.setLatencyTracing (true);
+
+		// Each publisher records on its own thread, whose histograms outlive it
+		for (int round=0; round<4; round++) {
+			vector<thread> publishers;
+			for (int i=0; i<4; i++)
+				publishers.emplace_back ([&] {
+					for (int j=0; j<10; j++)
+						manager.triggerEvent (temperature, Json::Value (j));
+				});
+			for (auto &publisher : publishers)
+				publisher.join ();
+
+			REQUIRE (handledCount (manager, id) == 40u * (round + 1));
+		}
+	}
+
+	SECTION( "Managers alternating on a thread" ) {
+		TestEventManager first, second;
+		SubscriptionId ids[2];
+		EventId events[2];
+		TestEventManager *managers[2]	= {&first, &second};
+		for (int i=0; i<2; i++) {
+			managers[i]->serviceJoin ("sensors");
+			events[i]	= managers[i]->registerEvent ("sensors", "temperature");
+			ids[i]		= managers[i]->onEvent (events[i], EventHandler ([] (Json::Value) {}), options);
+			managers[i]->setLatencyTracing (true);
+		}
+
+		for (int i=0; i<100; i++)
+			managers[i % 2]->triggerEvent (events[i % 2], Json::Value (i));
+
+		REQUIRE (handledCount (first, ids[0]) == 50);
+		REQUIRE (handledCount (second, ids[1]) == 50);
+	}
+
+	SECTION( "A manager replacing a destroyed one" ) {
+		// The new manager may take the address of the old one, but not its histograms
+		for (int round=0; round<3; round++) {
+			unique_ptr<TestEventManager> manager (new TestEventManager ());
+			manager->serviceJoin ("sensors");
+			EventId temperature	= manager->registerEvent ("sensors", "temperature");
+			SubscriptionId id	= manager->onEvent (temperature, EventHandler ([] (Json::Value) {}), options);
+			manager->setLatencyTracing (true);
+
+			for (int i=0; i<=round; i++)
+				manager->triggerEvent (temperature, Json::Value (i));
+			REQUIRE (handledCount (*manager, id) == static_cast<uint64_t> (round + 1));
+		}
+	}
+}
@@ -0,0 +1,441 @@
+#define CATCH_CONFIG_MAIN
+
+#include <thirdParty/catch.hpp>
+#include <core/microservicespp.hpp>
+#include <engineDouble.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <future>
+#include <map>
+
+#include <unistd.h>
+#include <dlfcn.h>
+
+using namespace std;
+using namespace microservicespp;
+
+
+static const string testModule		= MODULES_DIR "/testService.so";
+static const string otherModule	= MODULES_DIR "/otherTestService.so";
+static const string missingModule	= MODULES_DIR "/missingService.so";
+
+
+// ServiceRegistry with the hooks Engine implements, forwarded to its own EventManager as Engine does
+class TestRegistry : private doubles::EngineHolder, public EventManager, public ServiceRegistry {
+	public :
+		TestRegistry () : EventManager (engineDouble), ServiceRegistry (engineDouble) {}
+
+		~TestRegistry () {
+			stopRegistry ();
+		}
+
+		using ServiceRegistry::declareService;
+		using ServiceRegistry::startServices;
+		using ServiceRegistry::getStartupReport;
+		using ServiceRegistry::existsService;
+		using ServiceRegistry::unloadService;
+		using ServiceRegistry::loadService;
+		using ServiceRegistry::loadReplicatedService;
+		using ServiceRegistry::reloadService;
+		using ServiceRegistry::getService;
+		using ServiceRegistry::declareLazyService;
+		using ServiceRegistry::startRegistry;
+		using EventManager::serviceJoin;
+		using EventManager::registerEvent;
+		using EventManager::getEventId;
+		using EventManager::onEvent;
+		using EventManager::triggerEvent;
+		using EventManager::onRequest;
+		using EventManager::request;
+
+	private :
+		void reloadBegin (const string &name) override {
+			holdSubscriptions (name);
+		}
+
+		void reloadPause (const string &name) override {
+			pauseSubscriptions (name);
+		}
+
+		vector<weak_ptr<const void>> reloadEnd (const string &name, bool commit) override {
+			return swapSubscriptions (name, commit);
+		}
+
+		void lazyArm (const string &name, const LazyActivation &activation, function<void ()> activate) override {
+			armActivation (name, activation.events, activation.endpoints, activate);
+		}
+
+		uint64_t lazyActivity (const string &name) override {
+			return getServiceActivity (name);
+		}
+
+		void replicateService (const string &name, const ReplicaOptions &options) override {
+			setReplicas (name, options);
+		}
+
+		void replicaBegin (const string &name, unsigned replica) override {
+			joinReplica (name, replica);
+		}
+
+		void replicaEnd (const string &name) override {
+			completeReplicas (name);
+		}
+};
+
+
+// Clears the hooks of the doubles when a test ends, also when it fails
+struct HooksGuard {
+	~HooksGuard () {
+		doubles::serviceCreated		= nullptr;
+		doubles::serviceStarting	= nullptr;
+	}
+};
+
+
+static bool isLoaded (const string &module) {
+	void *handle	= dlopen (module.c_str (), RTLD_NOW | RTLD_NOLOAD);
+	if (handle)
+		dlclose (handle);
+	return handle != nullptr;
+}
+
+
+template <typename Predicate>
+static bool eventually (Predicate predicate) {
+	for (int i=0; i<2000 && !predicate (); i++)
+		this_thread::sleep_for (chrono::milliseconds (1));
+	return predicate ();
+}
+
+
+static vector<string> startedNames (const vector<ServiceStartup> &report) {
+	vector<string> names;
+	for (auto &startup : report)
+		names.push_back (startup.name);
+	sort (names.begin (), names.end ());
+	return names;
+}
+
+
+
+
+TEST_CASE( "Starting declared services" ) {
+	TestRegistry registry;
+
+	SECTION( "Services not depending on a failed one" ) {
+		unlink (missingModule.c_str ());
+
+		registry.declareService (missingModule, "broken", 1);
+		registry.declareService (testModule, "independent", 1);
+		registry.declareService (testModule, "dependent", 1, {"broken"});
+
+		REQUIRE_THROWS_AS (registry.startServices (), exceptions::ServiceRegistryException);
+		REQUIRE (startedNames (registry.getStartupReport ()) == vector<string> ({"independent"}));
+		REQUIRE (registry.existsService ("independent"));
+		REQUIRE_FALSE (registry.existsService ("broken"));
+		REQUIRE_FALSE (registry.existsService ("dependent"));
+
+		// Services not started are still declared
+		REQUIRE_THROWS_AS (registry.declareService (testModule, "broken", 1), exceptions::ServiceRegistryException);
+		REQUIRE_THROWS_AS (registry.declareService (testModule, "dependent", 1), exceptions::ServiceRegistryException);
+
+		// Once their module exists, a new start retries them
+		REQUIRE (symlink (testModule.c_str (), missingModule.c_str ()) == 0);
+		vector<ServiceStartup> report	= registry.startServices ();
+		unlink (missingModule.c_str ());
+
+		REQUIRE (startedNames (report) == vector<string> ({"broken", "dependent"}));
+		REQUIRE (report.front ().name == "broken");
+		REQUIRE (registry.existsService ("broken"));
+		REQUIRE (registry.existsService ("dependent"));
+	}
+
+	SECTION( "Services of higher run levels wait for lower ones" ) {
+		registry.declareService (testModule, "upper", 2);
+		registry.declareService (testModule, "lower", 1);
+
+		vector<ServiceStartup> report	= registry.startServices ();
+		REQUIRE (report.size () == 2);
+		REQUIRE (report[0].name == "lower");
+		REQUIRE (report[1].name == "upper");
+		REQUIRE (registry.startServices ().empty ());
+	}
+
+	SECTION( "Rejected dependencies" ) {
+		registry.declareService (testModule, "first", 1, {"unknown"});
+		registry.declareService (testModule, "second", 1, {"first"});
+		registry.declareService (testModule, "other", 1);
+
+		REQUIRE_THROWS_AS (registry.startServices (), exceptions::ServiceRegistryException);
+		REQUIRE (registry.getStartupReport ().empty ());
+
+		// Rejected services are discarded, the others go on waiting
+		registry.declareService (testModule, "first", 1);
+		REQUIRE (startedNames (registry.startServices ()) == vector<string> ({"first", "other"}));
+	}
+}
+
+
+
+
+TEST_CASE( "Closing modules of replaced instances" ) {
+	HooksGuard guard;
+	TestRegistry registry;
+	registry.serviceJoin ("sensors");
+	EventId temperature	= registry.registerEvent ("sensors", "temperature");
+
+	// Each instance subscribes on its own behalf, counting the payloads it handles
+	vector<Service *> instances;
+	atomic<unsigned> handled (0);
+	doubles::serviceCreated	= [&] (Service &instance) {
+		SubscriptionOptions options;
+		options.owner	= instance.getName ();
+
+		instances.push_back (&instance);
+		registry.onEvent (temperature, EventHandler ([&] (Json::Value) { handled++; }), options);
+	};
+
+	registry.loadService (testModule, "monitor", 1);
+	REQUIRE (isLoaded (testModule));
+	REQUIRE_FALSE (isLoaded (otherModule));
+
+	// Reloading back and forth, only the module of the running instance stays loaded
+	for (int i=0; i<4; i++) {
+		const string &current	= (i % 2 == 0) ? testModule : otherModule;
+		const string &next		= (i % 2 == 0) ? otherModule : testModule;
+
+		registry.reloadService ("monitor", next);
+		REQUIRE (isLoaded (next));
+		REQUIRE_FALSE (isLoaded (current));
+	}
+
+	// Payloads reach only the last instance
+	Json::Value payload (0);
+	registry.triggerEvent (temperature, payload);
+	REQUIRE (eventually ([&] { return handled == 1; }));
+	this_thread::sleep_for (chrono::milliseconds (50));
+	REQUIRE (handled == 1);
+
+	registry.unloadService ("monitor");
+	REQUIRE_FALSE (isLoaded (testModule));
+	REQUIRE_FALSE (isLoaded (otherModule));
+	REQUIRE (instances.size () == 5);
+}
+
+
+
+
+TEST_CASE( "Keeping services by their handles" ) {
+	TestRegistry registry;
+	registry.loadService (testModule, "monitor", 1);
+
+	shared_ptr<Service> first	= registry.getService ("monitor");
+	REQUIRE (first->getName () == "monitor");
+	REQUIRE (first->getStatus () == ServiceStatus::Running);
+	REQUIRE (registry.getService (string ("monitor")) == first);
+	REQUIRE_THROWS_AS (registry.getService ("unknown"), exceptions::ServiceRegistryException);
+
+	SECTION( "Reloaded service" ) {
+		registry.reloadService ("monitor", otherModule);
+
+		// The old instance is stopped, but it and its module live as long as the handle
+		shared_ptr<Service> second	= registry.getService ("monitor");
+		REQUIRE (second != first);
+		REQUIRE (second->getStatus () == ServiceStatus::Running);
+		REQUIRE (first->getStatus () == ServiceStatus::Died);
+		REQUIRE (first->getName () == "monitor");
+		REQUIRE (isLoaded (testModule));
+
+		first.reset ();
+		registry.unloadService ("monitor");
+		REQUIRE_FALSE (isLoaded (testModule));
+	}
+
+	SECTION( "Unloaded service" ) {
+		registry.unloadService ("monitor");
+		REQUIRE_FALSE (registry.existsService ("monitor"));
+		REQUIRE (first->getStatus () == ServiceStatus::Died);
+		REQUIRE (isLoaded (testModule));
+
+		first.reset ();
+		REQUIRE_FALSE (isLoaded (testModule));
+	}
+}
+
+
+
+
+TEST_CASE( "Activating lazy services" ) {
+	HooksGuard guard;
+	TestRegistry registry;
+	registry.serviceJoin ("sensors");
+	EventId temperature	= registry.registerEvent ("sensors", "temperature");
+
+	// Each instance subscribes on its own behalf, collecting the payloads it handles
+	mutex receivedMutex;
+	vector<int> received;
+	atomic<unsigned> created (0);
+	doubles::serviceCreated	= [&] (Service &instance) {
+		SubscriptionOptions options;
+		options.owner	= instance.getName ();
+
+		created++;
+		registry.onEvent (temperature, EventHandler ([&] (Json::Value value) {
+			unique_lock<mutex> lock (receivedMutex);
+			received.push_back (value.asInt ());
+		}), options);
+		registry.onRequest (registry.getEventId ("monitor", "status"), [] (const Json::Value &) { return Json::Value ("ok"); },
+							options);
+	};
+	auto receivedValues	= [&] () {
+		unique_lock<mutex> lock (receivedMutex);
+		return received;
+	};
+	auto trigger	= [&] (int from, int to) {
+		for (int i=from; i<to; i++) {
+			Json::Value payload (i);
+			registry.triggerEvent (temperature, payload);
+		}
+	};
+
+	LazyActivation activation;
+	activation.events.push_back ("sensors/temperature");
+	activation.endpoints.push_back ("status");
+
+	SECTION( "On the first event, until idle" ) {
+		activation.idleTimeout	= 100;
+		registry.declareLazyService (testModule, "monitor", 1, activation);
+		registry.startRegistry ();
+
+		// Nothing is loaded before an event comes, which is kept for the service with those following it
+		this_thread::sleep_for (chrono::milliseconds (50));
+		REQUIRE (created == 0);
+		REQUIRE_FALSE (registry.existsService ("monitor"));
+		REQUIRE_FALSE (isLoaded (testModule));
+
+		trigger (0, 3);
+		REQUIRE (eventually ([&] { return receivedValues ().size () == 3; }));
+		REQUIRE (receivedValues () == vector<int> ({0, 1, 2}));
+		REQUIRE (eventually ([&] { return registry.existsService ("monitor"); }));
+		REQUIRE (created == 1);
+
+		// Once idle it is stopped, keeping its module for the next activation
+		REQUIRE (eventually ([&] { return !registry.existsService ("monitor"); }));
+		REQUIRE (isLoaded (testModule));
+
+		trigger (3, 5);
+		REQUIRE (eventually ([&] { return receivedValues ().size () == 5; }));
+		REQUIRE (receivedValues () == vector<int> ({0, 1, 2, 3, 4}));
+		REQUIRE (created == 2);
+	}
+
+	SECTION( "On a request" ) {
+		registry.declareLazyService (testModule, "monitor", 1, activation);
+		registry.startRegistry ();
+
+		// The reply may come before the registry lists the service
+		REQUIRE (registry.request ("monitor", "status", Json::Value ()).get () == Json::Value ("ok"));
+		REQUIRE (eventually ([&] { return registry.existsService ("monitor"); }));
+		REQUIRE (created == 1);
+	}
+
+	SECTION( "Retrying a failed activation" ) {
+		unlink (missingModule.c_str ());
+		registry.declareLazyService (missingModule, "monitor", 1, activation);
+		registry.startRegistry ();
+
+		trigger (0, 2);
+		this_thread::sleep_for (chrono::milliseconds (100));
+		REQUIRE_FALSE (registry.existsService ("monitor"));
+
+		// The next attempt finds the module, and the payloads kept meanwhile
+		REQUIRE (symlink (testModule.c_str (), missingModule.c_str ()) == 0);
+		bool activated	= eventually ([&] { return receivedValues ().size () == 2; });
+		unlink (missingModule.c_str ());
+
+		REQUIRE (activated);
+		REQUIRE (receivedValues () == vector<int> ({0, 1}));
+		REQUIRE (eventually ([&] { return registry.existsService ("monitor"); }));
+	}
+
+	SECTION( "Declared twice" ) {
+		registry.declareLazyService (testModule, "monitor", 1, activation);
+		REQUIRE_THROWS_AS (registry.declareLazyService (testModule, "monitor", 1, activation), exceptions::ServiceRegistryException);
+		REQUIRE_THROWS_AS (registry.declareService (testModule, "monitor", 1), exceptions::ServiceRegistryException);
+	}
+}
+
+
+
+
+TEST_CASE( "Loading replicated services" ) {
+	HooksGuard guard;
+	TestRegistry registry;
+	registry.serviceJoin ("sensors");
+	EventId temperature	= registry.registerEvent ("sensors", "temperature");
+
+	// Each instance subscribes on its own behalf, unless it is told not to
+	mutex receivedMutex;
+	map<Service *, vector<int>> received;
+	atomic<unsigned> created (0);
+	unsigned subscribing	= 3;
+	doubles::serviceCreated	= [&] (Service &instance) {
+		SubscriptionOptions options;
+		options.owner	= instance.getName ();
+
+		if (created++ >= subscribing)
+			return;
+		Service *handler	= &instance;
+		registry.onEvent (temperature, EventHandler ([&, handler] (Json::Value value) {
+			unique_lock<mutex> lock (receivedMutex);
+			received[handler].push_back (value.asInt ());
+		}), options);
+	};
+	auto receivedValues	= [&] () {
+		unique_lock<mutex> lock (receivedMutex);
+		vector<int> values;
+		for (auto &instance : received)
+			values.insert (values.end (), instance.second.begin (), instance.second.end ());
+		sort (values.begin (), values.end ());
+		return values;
+	};
+
+	ReplicaOptions replication;
+	replication.replicas	= 3;
+
+	SECTION( "Instances share the payloads" ) {
+		registry.loadReplicatedService (testModule, "monitor", 1, replication);
+		REQUIRE (created == 3);
+		REQUIRE (registry.existsService ("monitor"));
+
+		for (int i=0; i<30; i++) {
+			Json::Value payload (i);
+			registry.triggerEvent (temperature, payload);
+		}
+		REQUIRE (eventually ([&] { return receivedValues ().size () == 30; }));
+
+		vector<int> expected;
+		for (int i=0; i<30; i++)
+			expected.push_back (i);
+		REQUIRE (receivedValues () == expected);
+	}
+
+	SECTION( "Instances making different subscriptions" ) {
+		subscribing	= 1;
+		REQUIRE_THROWS_AS (registry.loadReplicatedService (testModule, "monitor", 1, replication), exceptions::EventManagerException);
+		REQUIRE (created == 3);
+		REQUIRE_FALSE (registry.existsService ("monitor"));
+
+		// Nothing is left of the failed service, which can be loaded again
+		subscribing	= 4;
+		registry.loadService (testModule, "monitor", 1);
+		REQUIRE (registry.existsService ("monitor"));
+	}
+}
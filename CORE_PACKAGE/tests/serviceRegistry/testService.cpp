@@ -0,0 +1,20 @@
+/**
+ * \file testService.cpp
+ * \author Luca Di Mauro
+ * \brief Module of a service doing nothing, loaded by the tests of ServiceRegistry
+ */
+
+#include <core/microservicespp.hpp>
+
+using namespace microservicespp;
+
+
+class TestService : public Service {
+	public :
+		TestService (std::string name, Engine &engine, int runLevel) : Service (name, engine, runLevel) {}
+};
+
+
+extern "C" Service *createObject (Engine *engine, std::string name, int runLevel) {
+	return new TestService (name, *engine, runLevel);
+}
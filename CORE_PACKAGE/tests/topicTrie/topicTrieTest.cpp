@@ -0,0 +1,44 @@
+#define CATCH_CONFIG_MAIN
+
+#include <thirdParty/catch.hpp>
+#include <core/topicTrie.hpp>
+#include <algorithm>
+
+using namespace std;
+using namespace microservicespp;
+using namespace utils;
+
+
+static vector<int> matching (const TopicTrie<int> &trie, const string &topic) {
+	vector<int> result;
+	trie.match (topic, result);
+	sort (result.begin (), result.end ());
+	return result;
+}
+
+
+TEST_CASE( "Matching topics against patterns" ) {
+	TopicTrie<int> trie;
+	trie.insert ("sensors/kitchen/temperature", 1);
+	trie.insert ("sensors/*/temperature", 2);
+	trie.insert ("*/status", 3);
+	trie.insert ("sensors/**", 4);
+	trie.insert ("**", 5);
+
+	REQUIRE (matching (trie, "sensors/kitchen/temperature") == vector<int> ({1, 2, 4, 5}));
+	REQUIRE (matching (trie, "sensors/garage/temperature") == vector<int> ({2, 4, 5}));
+	REQUIRE (matching (trie, "sensors/garage/humidity") == vector<int> ({4, 5}));
+	REQUIRE (matching (trie, "sensors") == vector<int> ({4, 5}));
+	REQUIRE (matching (trie, "engine/status") == vector<int> ({3, 5}));
+	REQUIRE (matching (trie, "engine/status/extra") == vector<int> ({5}));
+
+	REQUIRE (trie.remove ("sensors/*/temperature", 2));
+	REQUIRE_FALSE (trie.remove ("sensors/*/temperature", 2));
+	REQUIRE (matching (trie, "sensors/garage/temperature") == vector<int> ({4, 5}));
+
+	REQUIRE (TopicTrie<int>::matches ("sensors/*/temperature", "sensors/kitchen/temperature"));
+	REQUIRE_FALSE (TopicTrie<int>::matches ("sensors/*/temperature", "sensors/kitchen"));
+	REQUIRE (TopicTrie<int>::matches ("sensors/**", "sensors"));
+
+	REQUIRE_THROWS (trie.insert ("**/temperature", 6));
+}
@@ -0,0 +1,227 @@
+#define CATCH_CONFIG_MAIN
+
+#include <thirdParty/catch.hpp>
+#include <core/utils.hpp>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+using namespace microservicespp;
+using namespace utils;
+
+
+struct Counted {
+	static atomic<int> alive;
+	int value;
+
+	Counted (int v) : value (v)	{ alive++; }
+	~Counted ()					{ alive--; }
+};
+atomic<int> Counted::alive (0);
+
+
+TEST_CASE( "Snapshots are replaced while being read" ) {
+	{
+		SnapshotPointer<Counted> pointer (new Counted (0));
+		atomic<bool> stop (false);
+		atomic<bool> failed (false);
+
+		vector<thread> readers;
+		for (int i=0; i<4; i++) {
+			readers.emplace_back ([&] {
+				while (!stop) {
+					auto snapshot	= pointer.read ();
+					int first		= snapshot->value;
+					this_thread::yield ();
+					if (snapshot->value != first)
+						failed	= true;
+				}
+			});
+		}
+
+		for (int i=1; i<=1000; i++)
+			pointer.publish (new Counted (i));
+
+		stop	= true;
+		for (auto &t : readers)
+			t.join ();
+
+		REQUIRE_FALSE (failed);
+		REQUIRE (pointer.read ()->value == 1000);
+		REQUIRE (Counted::alive == 1);
+	}
+
+	REQUIRE (Counted::alive == 0);
+}
+
+
+TEST_CASE( "Snapshots are read by more threads than reader shards" ) {
+	SnapshotPointer<Counted> pointer (new Counted (0));
+	atomic<bool> stop (false);
+	atomic<int> regressions (0);
+
+	// Each reader must never see an older value than the one it saw before
+	vector<thread> readers;
+	for (int i=0; i<40; i++) {
+		readers.emplace_back ([&] {
+			int last	= 0;
+			while (!stop) {
+				int value	= pointer.read ()->value;
+				if (value < last)
+					regressions++;
+				last	= value;
+				this_thread::yield ();
+			}
+		});
+	}
+
+	for (int i=1; i<=100; i++)
+		pointer.publish (new Counted (i));
+
+	stop	= true;
+	for (auto &t : readers)
+		t.join ();
+
+	REQUIRE (regressions == 0);
+	REQUIRE (pointer.read ()->value == 100);
+	REQUIRE (Counted::alive == 1);
+}
+
+
+TEST_CASE( "Timers run in deadline order" ) {
+	mutex resultsMutex;
+	vector<int> results;
+
+	{
+		TimerQueue timers;
+		auto now	= TimerQueue::Clock::now ();
+
+		for (int i : {3, 1, 2}) {
+			timers.schedule (now + chrono::milliseconds (10 * i), [&, i] {
+				lock_guard<mutex> lock (resultsMutex);
+				results.push_back (i);
+			});
+		}
+		timers.schedule (now + chrono::hours (1), [&] {
+			lock_guard<mutex> lock (resultsMutex);
+			results.push_back (0);
+		});
+
+		this_thread::sleep_for (chrono::milliseconds (100));
+	}
+
+	REQUIRE (results == vector<int> ({1, 2, 3}));
+}
+
+
+TEST_CASE( "Token buckets allow bursts and then the rate" ) {
+	// One token every 10 ms, up to 5 at once
+	TokenBucket bucket (100, 5);
+	int64_t start	= steadyNanoseconds ();
+
+	for (int i=0; i<5; i++)
+		REQUIRE (bucket.tryAcquire (start));
+	REQUIRE_FALSE (bucket.tryAcquire (start));
+
+	REQUIRE (bucket.tryAcquire (start + 10000000));
+	REQUIRE_FALSE (bucket.tryAcquire (start + 10000000));
+
+	// Reserved tokens are taken even if they are not available yet
+	REQUIRE (bucket.reserve (start + 10000000, 2) == 20000000);
+	REQUIRE_FALSE (bucket.tryAcquire (start + 30000000));
+	REQUIRE (bucket.tryAcquire (start + 40000000));
+
+	// Refunded tokens can be taken again
+	REQUIRE_FALSE (bucket.tryAcquire (start + 40000000));
+	bucket.refund (1);
+	REQUIRE (bucket.tryAcquire (start + 40000000));
+}
+
+
+TEST_CASE( "Token buckets reject rates and bursts their times cannot represent" ) {
+	REQUIRE (TokenBucket::isValid (1e9, 1));
+	REQUIRE (TokenBucket::isValid (0.001, 1000));
+	REQUIRE_FALSE (TokenBucket::isValid (0, 1));
+	REQUIRE_FALSE (TokenBucket::isValid (-1, 1));
+	REQUIRE_FALSE (TokenBucket::isValid (2e9, 1));
+	REQUIRE_FALSE (TokenBucket::isValid (1e-12, 1));
+	REQUIRE_FALSE (TokenBucket::isValid (1, 0));
+	REQUIRE_FALSE (TokenBucket::isValid (1, 4000000000u));
+
+	// Asking for more tokens than a bucket holds neither overflows nor succeeds
+	TokenBucket bucket (0.001, 1000);
+	REQUIRE_FALSE (bucket.tryAcquire (0, 4000000000u));
+	REQUIRE (bucket.tryAcquire (0, 1000));
+}
+
+
+TEST_CASE( "Latency histograms keep percentiles within their precision" ) {
+	LatencyHistogram histogram;
+	for (uint64_t i=1; i<=1000; i++)
+		histogram.record (i * 1000);
+
+	REQUIRE (histogram.count () == 1000);
+	REQUIRE (histogram.max () == 1000000);
+	REQUIRE (histogram.mean () == Approx (500500));
+
+	uint64_t median	= histogram.percentile (50);
+	REQUIRE (median >= 500000);
+	REQUIRE (median <= 500000 + 500000 / 16);
+	REQUIRE (histogram.percentile (100) == 1000000);
+
+	LatencyHistogram merged;
+	merged.record (5);
+	merged.merge (histogram);
+	REQUIRE (merged.count () == 1001);
+	REQUIRE (merged.percentile (0) == 5);
+}
+
+
+TEST_CASE( "Frozen string maps find every key they are built from" ) {
+	vector<pair<string, int>> entries;
+	for (int i=0; i<100; i++)
+		entries.emplace_back ("service" + to_string (i), i);
+	entries.emplace_back ("service7", 700);
+
+	FrozenStringMap<int> map (entries);
+	REQUIRE (map.size () == 100);
+
+	for (int i=0; i<100; i++) {
+		const int *value	= map.find ("service" + to_string (i));
+		REQUIRE (value != nullptr);
+		REQUIRE (*value == (i == 7 ? 700 : i));
+	}
+
+	REQUIRE (map.find ("service100") == nullptr);
+	REQUIRE (map.find ("") == nullptr);
+	REQUIRE (FrozenStringMap<int> ().find ("service1") == nullptr);
+}
+
+
+TEST_CASE( "Shared vectors keep copies independent" ) {
+	SharedVector<int> original;
+	for (int i=0; i<5000; i++)
+		original.push_back (i);
+	REQUIRE (original.size () == 5000);
+
+	// Changes of a copy are not seen by the original, and the other way round
+	SharedVector<int> copy	= original;
+	for (int i=0; i<5000; i+=7)
+		copy.set (i, -i);
+	copy.push_back (5000);
+	original.set (1, 100);
+
+	vector<int> originalValues, copyValues, expectedOriginal, expectedCopy;
+	for (size_t i=0; i<original.size (); i++)
+		originalValues.push_back (original[i]);
+	for (size_t i=0; i<copy.size (); i++)
+		copyValues.push_back (copy[i]);
+	for (int i=0; i<5000; i++) {
+		expectedOriginal.push_back (i == 1 ? 100 : i);
+		expectedCopy.push_back (i % 7 == 0 ? -i : i);
+	}
+	expectedCopy.push_back (5000);
+
+	REQUIRE (originalValues == expectedOriginal);
+	REQUIRE (copyValues == expectedCopy);
+}